@@ -1,12 +1,39 @@
 #include "common.h"
+#include "gl_debug.hpp"
+#include <string.h>
 
 bool CheckOpenGLError(const char *stmt, const char *fname, int line) {
   GLenum err = glGetError();
   if (err != GL_NO_ERROR) {
-    printf("OpenGL error %08x, at %s:%i - for %s\n", err, fname, line, stmt);
+    gl_debug_log("OpenGL error %08x, at %s:%i - for %s", err, fname, line,
+                 stmt);
     return false;
-  } else {
-    std::cout << "oK " << stmt << "\n";
+  }
+  return true;
+}
+
+static unsigned check_interval = 64;
+static thread_local unsigned check_countdown = 0;
+
+void set_gl_check_interval(unsigned interval) {
+  check_interval = interval ? interval : 1;
+}
+
+bool CheckOpenGLErrorSampled(const char *stmt, const char *fname, int line) {
+  if (check_countdown-- > 0)
     return true;
+  check_countdown = check_interval - 1;
+  return CheckOpenGLError(stmt, fname, line);
+}
+
+bool gl_has_extension(const char *name) {
+  auto exts = (const char *)glGetString(GL_EXTENSIONS);
+  if (exts == nullptr)
+    return false;
+  size_t len = strlen(name);
+  for (const char *p = strstr(exts, name); p; p = strstr(p + len, name)) {
+    if ((p == exts || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0'))
+      return true;
   }
+  return false;
 }
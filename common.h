@@ -2,10 +2,41 @@
 #include "glad/gles2.h"
 #include <iostream>
 
+/*
+ * GL_CHECK_LEVEL, set by CMake from the GL_CHECKS option:
+ * 2 - glGetError after every checked call
+ * 1 - sampled, only every Nth check queries glGetError (see
+ *     set_gl_check_interval), the error found may come from an earlier call
+ * 0 - compiled out, the statement runs and counts as successful
+ * Failures are queued instead of printed, see gl_debug.hpp. GL_VERIFY
+ * always checks, for setup code that acts on the result.
+ */
+#ifndef GL_CHECK_LEVEL
+#define GL_CHECK_LEVEL 2
+#endif
+
 bool CheckOpenGLError(const char *stmt, const char *fname, int line);
+bool CheckOpenGLErrorSampled(const char *stmt, const char *fname, int line);
+bool gl_has_extension(const char *name);
 
-#define GL_CHECK(stmt)                                                         \
+#define GL_VERIFY(stmt)                                                        \
   [&]() {                                                                      \
     stmt;                                                                      \
     return CheckOpenGLError(#stmt, __FILE__, __LINE__);                        \
   }()
+
+#if GL_CHECK_LEVEL >= 2
+#define GL_CHECK(stmt) GL_VERIFY(stmt)
+#elif GL_CHECK_LEVEL == 1
+#define GL_CHECK(stmt)                                                         \
+  [&]() {                                                                      \
+    stmt;                                                                      \
+    return CheckOpenGLErrorSampled(#stmt, __FILE__, __LINE__);                 \
+  }()
+#else
+#define GL_CHECK(stmt)                                                         \
+  [&]() {                                                                      \
+    stmt;                                                                      \
+    return true;                                                               \
+  }()
+#endif
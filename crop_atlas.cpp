@@ -0,0 +1,190 @@
+#include "crop_atlas.hpp"
+#include "common.h"
+#include "downscale.hpp"
+#include "gl_state.hpp"
+#include "shader.hpp"
+#include <algorithm>
+#include <cmath>
+#include <drm/drm_fourcc.h>
+#include <stdio.h>
+#include <unistd.h>
+
+static void draw_atlas_pass(crop_atlas &atlas, int p,
+                            const graph_pass_context &ctx) {
+  // no crops, the clear of the target is all
+  if (atlas.num_crops == 0)
+    return;
+  use_output_prog(atlas.spec.crop, atlas.progs[p], atlas.source, ctx);
+  gl_state_bind_array_buffer(atlas.vbo);
+  gl_state_vertex_attrib(ATTRIB_POS, 4, GL_FLOAT, 0, 0);
+  GL_CHECK(glDrawArrays(GL_TRIANGLES, 0, 6 * atlas.num_crops));
+  gl_state_bind_fullscreen_quad();
+}
+
+crop_atlas create_crop_atlas(const v4l2_device_info &dev,
+                             const v4l2_dma_device_info &dma,
+                             EGLDisplay disp, const crop_atlas_spec &spec,
+                             int in_w, int in_h, int num_slots) {
+  const auto &crop = spec.crop;
+  if (spec.max_crops < 1) {
+    printf("Crop atlas needs room for at least one crop\n");
+    return {};
+  }
+  auto passes = output_format_passes(crop.drm_format);
+  for (auto pass : passes) {
+    if (pass == output_pass::pack_rgb || pass == output_pass::pack_r) {
+      printf("Crop atlas doesn't support packed formats\n");
+      return {};
+    }
+  }
+  // NV12 subsamples 2x2
+  if (crop.w % 2 != 0 || crop.h % 2 != 0) {
+    printf("Crops have to be multiples of 2x2, not %dx%d\n", crop.w, crop.h);
+    return {};
+  }
+  if (crop.norm.enabled && crop.drm_format == DRM_FORMAT_NV12) {
+    printf("Normalization is not supported for NV12 outputs\n");
+    return {};
+  }
+
+  crop_atlas out;
+  out.spec = spec;
+  out.in_w = in_w;
+  out.in_h = in_h;
+  out.cols = spec.cols > 0
+                 ? std::min(spec.cols, spec.max_crops)
+                 : (int)std::ceil(std::sqrt((float)spec.max_crops));
+  int rows = (spec.max_crops + out.cols - 1) / out.cols;
+  out.w = out.cols * crop.w;
+  out.h = rows * crop.h;
+  out.frames = create_egl_frame(dev, dma, disp, num_slots, out.w, out.h,
+                                crop.drm_format);
+  if (out.frames.size() != (size_t)num_slots) {
+    printf("Failed to create crop atlas %dx%d\n", out.w, out.h);
+    return {};
+  }
+  output_spec frame_spec = crop;
+  frame_spec.w = out.w;
+  frame_spec.h = out.h;
+  auto tensor = describe_output_tensor(frame_spec);
+  if (out.cols == 1) {
+    tensor.dims[0] = spec.max_crops;
+    tensor.dims[2] = crop.h;
+    tensor.strides[0] = tensor.strides[2] * crop.h;
+  }
+  for (auto &frame : out.frames)
+    frame.tensor = tensor;
+
+  GL_CHECK(glGenBuffers(1, &out.vbo));
+  out.vertices.reserve(spec.max_crops * 6 * 4);
+
+  auto &graph = out.graph;
+  out.input_res =
+      import_graph_texture(graph, "capture", GL_TEXTURE_EXTERNAL_OES);
+  out.source.res = out.input_res;
+  out.source.texel_w = 1.0f / in_w;
+  out.source.texel_h = 1.0f / in_h;
+
+  // crops are single pass like the mosaic cells
+  auto plan = plan_downscale(output_downscale::none, in_w, in_h, crop.w,
+                             crop.h);
+  auto variants =
+      output_pass_variants(crop, shader_input::external, plan.filter);
+  for (auto &variant : variants)
+    variant.defines += "#define VERTEX_UV\n";
+  precompile_variants(variants);
+  for (size_t p = 0; p < passes.size(); p++) {
+    out.progs.push_back(load_output_prog(get_variant_program(variants[p])));
+    auto name = "crops." + std::to_string(p);
+    int target = import_graph_target(
+        graph, name, output_pass_bytes_per_pixel(crop.drm_format, passes[p]));
+    out.target_res.push_back(target);
+    int id = add_graph_pass(graph, name, {out.input_res}, target,
+                            [p](const graph_pass_context &ctx) {
+                              draw_atlas_pass(*(crop_atlas *)ctx.user, p,
+                                              ctx);
+                            });
+    // padding and unused tiles
+    graph.passes[id].load = graph_load_op::clear;
+    output_pass_clear_color(crop, p, graph.passes[id].clear_color);
+  }
+  if (!compile_render_graph(graph))
+    return {};
+  printf("Crop atlas: %d %dx%d crops in %dx%d\n", spec.max_crops, crop.w,
+         crop.h, out.w, out.h);
+  return out;
+}
+
+// two triangles like the fullscreen quad, atlas pixels to clip space
+static void add_quad(crop_atlas &atlas, float x, float y, float w, float h,
+                     const output_crop &uv) {
+  float x0 = x / atlas.w * 2 - 1, x1 = (x + w) / atlas.w * 2 - 1;
+  float y0 = y / atlas.h * 2 - 1, y1 = (y + h) / atlas.h * 2 - 1;
+  float u0 = uv.x, u1 = uv.x + uv.w;
+  float v0 = uv.y, v1 = uv.y + uv.h;
+  float quad[] = {x0, y0, u0, v0, x1, y0, u1, v0, x0, y1, u0, v1,
+                  x0, y1, u0, v1, x1, y0, u1, v0, x1, y1, u1, v1};
+  atlas.vertices.insert(atlas.vertices.end(), quad, quad + 24);
+}
+
+crop_atlas_batch render_crop_atlas(EGLDisplay disp, crop_atlas &atlas,
+                                   GLuint capture_tex,
+                                   const std::vector<crop_roi> &rois,
+                                   int slot) {
+  crop_atlas_batch batch;
+  const auto &crop = atlas.spec.crop;
+  atlas.vertices.clear();
+  int n = std::min((int)rois.size(), atlas.spec.max_crops);
+  for (int i = 0; i < n; i++) {
+    const auto &roi = rois[i];
+    float x0 = std::max(roi.x, 0.0f), y0 = std::max(roi.y, 0.0f);
+    float x1 = std::min(roi.x + roi.w, (float)atlas.in_w);
+    float y1 = std::min(roi.y + roi.h, (float)atlas.in_h);
+    crop_atlas_tile tile;
+    tile.x = (i % atlas.cols) * crop.w;
+    tile.y = (i / atlas.cols) * crop.h;
+    tile.w = crop.w;
+    tile.h = crop.h;
+    if (x1 <= x0 || y1 <= y0) {
+      // outside the frame, the tile stays padding
+      batch.tiles.push_back(tile);
+      continue;
+    }
+    output_spec spec = crop;
+    spec.crop = {x0 / atlas.in_w, y0 / atlas.in_h, (x1 - x0) / atlas.in_w,
+                 (y1 - y0) / atlas.in_h};
+    auto layout = compute_output_layout(spec, atlas.in_w, atlas.in_h);
+    tile.transform = layout.transform;
+    tile.transform.offset_x -= tile.x * tile.transform.scale_x;
+    tile.transform.offset_y -= tile.y * tile.transform.scale_y;
+    batch.tiles.push_back(tile);
+    add_quad(atlas, tile.x + layout.vp_x, tile.y + layout.vp_y, layout.vp_w,
+             layout.vp_h, layout.uv);
+  }
+  atlas.num_crops = atlas.vertices.size() / 24;
+  if (atlas.num_crops > 0) {
+    // orphans the previous contents, the GPU may still read them
+    gl_state_bind_array_buffer(atlas.vbo);
+    GL_CHECK(glBufferData(GL_ARRAY_BUFFER,
+                          atlas.vertices.size() * sizeof(float),
+                          atlas.vertices.data(), GL_STREAM_DRAW));
+  }
+
+  bind_graph_texture(atlas.graph, atlas.input_res, capture_tex);
+  auto &frame = atlas.frames[slot];
+  for (size_t p = 0; p < atlas.target_res.size(); p++) {
+    if (frame.planes.empty())
+      bind_graph_target(atlas.graph, atlas.target_res[p], frame.fb, frame.w,
+                        frame.h);
+    else
+      bind_graph_target(atlas.graph, atlas.target_res[p], frame.planes[p].fb,
+                        frame.planes[p].w, frame.planes[p].h);
+  }
+  execute_render_graph(atlas.graph, &atlas);
+
+  batch.fence = create_frame_fence(disp, -1);
+  destroy_frame_fence(disp, frame.fence);
+  frame.fence.fd = batch.fence.fd >= 0 ? dup(batch.fence.fd)
+                                       : export_dmabuf_fence(frame.fd);
+  return batch;
+}
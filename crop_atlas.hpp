@@ -0,0 +1,76 @@
+#pragma once
+
+#include "output_spec.hpp"
+#include <vector>
+
+/*
+ * Second stage model inputs: the detections of a frame cropped from its
+ * full resolution capture, resized to the input of a classifier or re-ID
+ * model and packed into the tiles of one atlas dmabuf. All crops are a
+ * single draw of batched quads with per-vertex texture coordinates, the
+ * cost hardly depends on their number and none of it is on the CPU.
+ */
+struct crop_atlas_spec {
+  // size, format, fit, pad color and preprocessing of one crop, its own
+  // crop and downscale are ignored. Packed formats (RGB888, planar) are
+  // not supported, their pixels are mapped per fragment.
+  output_spec crop;
+  int max_crops = 32;
+  // tiles per atlas row, 0 picks ceil(sqrt(max_crops)), 1 stacks the
+  // crops as a batch of crop sized tensors
+  int cols = 0;
+};
+
+// region of the capture in sensor pixels
+struct crop_roi {
+  float x, y, w, h;
+};
+
+/*
+ * Tile of a crop in the atlas. `transform` maps atlas pixels inside the
+ * tile back to sensor pixels.
+ */
+struct crop_atlas_tile {
+  int x, y, w, h;
+  frame_transform transform;
+};
+
+struct crop_atlas {
+  crop_atlas_spec spec;
+  int w = 0, h = 0, cols = 0;
+  int in_w = 0, in_h = 0;
+  std::vector<egl_dma_frame> frames;
+  // one program per pass of the crop format
+  std::vector<output_prog> progs;
+  output_source source;
+  // pos.xy, uv per vertex, 6 vertices per crop
+  GLuint vbo = 0;
+  std::vector<float> vertices;
+  int num_crops = 0;
+  render_graph graph;
+  int input_res = -1;
+  std::vector<int> target_res;
+};
+
+// the capture is `in_w` x `in_h`, frames come from the heap of `dma`
+crop_atlas create_crop_atlas(const v4l2_device_info &dev,
+                             const v4l2_dma_device_info &dma,
+                             EGLDisplay disp, const crop_atlas_spec &spec,
+                             int in_w, int in_h, int num_slots);
+
+struct crop_atlas_batch {
+  egl_frame_fence fence;
+  // tiles[i] holds rois[i]
+  std::vector<crop_atlas_tile> tiles;
+};
+
+/*
+ * Renders `rois` of the capture texture `capture_tex` into `slot` and
+ * fences the batch like render_output_batch. ROIs are clipped to the
+ * frame, those beyond max_crops are dropped. The capture has to stay
+ * queued until the fence signals, see find_render_frame.
+ */
+crop_atlas_batch render_crop_atlas(EGLDisplay disp, crop_atlas &atlas,
+                                   GLuint capture_tex,
+                                   const std::vector<crop_roi> &rois,
+                                   int slot);
@@ -0,0 +1,432 @@
+#include "downscale.hpp"
+#include "common.h"
+#include "gl_state.hpp"
+#include "render_graph.hpp"
+#include "resample_filter.hpp"
+#include <chrono>
+#include <cmath>
+#include <stdio.h>
+
+// taps of one Lanczos axis and of one area axis
+static const int max_axis_taps = 8;
+static const int max_area_taps = 3;
+
+static float lanczos2(float x) {
+  x = std::fabs(x);
+  if (x < 1e-6f)
+    return 1;
+  if (x >= 2)
+    return 0;
+  float px = M_PI * x;
+  return 2 * std::sin(px) * std::sin(px / 2) / (px * px);
+}
+
+// bilinear fetches needed to cover r texels
+static int area_taps(float r) { return std::max(1, (int)std::ceil(r / 2)); }
+
+static int lanczos_taps(float r) {
+  return std::min(max_axis_taps, (int)std::ceil(4 * std::max(r, 1.0f)));
+}
+
+static std::string kernel_name(const char *kind, float a, float b) {
+  char name[64];
+  snprintf(name, sizeof(name), "%s_%.4f_%.4f", kind, a, b);
+  return name;
+}
+
+/*
+ * Every bilinear fetch averages about 2x2 texels, spread evenly over the
+ * rx x ry footprint
+ */
+static std::string area_kernel(float rx, float ry) {
+  auto name = kernel_name("area", rx, ry);
+  if (!find_kernel(name).taps.empty())
+    return name;
+  resample_kernel k = {name, {}};
+  int nx = std::min(max_area_taps, area_taps(rx));
+  int ny = std::min(max_area_taps, area_taps(ry));
+  for (int j = 0; j < ny; j++) {
+    for (int i = 0; i < nx; i++) {
+      k.taps.push_back({nx == 1 ? 0 : ((i + 0.5f) / nx - 0.5f) * rx,
+                        ny == 1 ? 0 : ((j + 0.5f) / ny - 0.5f) * ry,
+                        1.0f / (nx * ny)});
+    }
+  }
+  register_kernel(k);
+  return name;
+}
+
+/*
+ * Lanczos2 stretched by the ratio r, sampled at evenly spaced bilinear
+ * fetches over its 4r texel support
+ */
+static std::string lanczos_kernel(float r, bool horizontal) {
+  r = std::max(r, 1.0f);
+  auto name = kernel_name(horizontal ? "lanczos_h" : "lanczos_v", r, 0);
+  if (!find_kernel(name).taps.empty())
+    return name;
+  resample_kernel k = {name, {}};
+  int n = lanczos_taps(r);
+  float step = 4 * r / n, sum = 0;
+  for (int i = 0; i < n; i++) {
+    float x = (i + 0.5f) * step - 2 * r;
+    float w = lanczos2(x / r);
+    // taps on the zero crossings are wasted fetches
+    if (std::fabs(w) < 1e-3f)
+      continue;
+    k.taps.push_back({horizontal ? x : 0, horizontal ? 0 : x, w});
+    sum += w;
+  }
+  for (auto &t : k.taps)
+    t.w /= sum;
+  register_kernel(k);
+  return name;
+}
+
+// texture fetches per pixel, the shaders sample the merged taps
+static int kernel_fetches(const std::string &name) {
+  return merge_bilinear_taps(find_kernel(name).taps).size();
+}
+
+downscale_plan plan_downscale(output_downscale mode, int src_w, int src_h,
+                              int dst_w, int dst_h) {
+  downscale_plan plan;
+  plan.mode = mode;
+  float out_px = (float)dst_w * dst_h;
+  if (mode == output_downscale::none) {
+    // the default filter of the output passes
+    plan.fetches = kernel_fetches("sharpen") * out_px;
+    return plan;
+  }
+  float rx = (float)src_w / dst_w;
+  float ry = (float)src_h / dst_h;
+  if (mode == output_downscale::area)
+    plan.prescale = area_taps(rx) > max_area_taps ||
+                    area_taps(ry) > max_area_taps;
+  else
+    plan.prescale = std::ceil(4 * rx) > max_axis_taps ||
+                    std::ceil(4 * ry) > max_axis_taps;
+  int rows = src_h;
+  if (plan.prescale) {
+    plan.pre_w = std::max(1, (int)std::lround(src_w / 2.0f));
+    plan.pre_h = std::max(1, (int)std::lround(src_h / 2.0f));
+    rx = (float)plan.pre_w / dst_w;
+    ry = (float)plan.pre_h / dst_h;
+    rows = plan.pre_h;
+    plan.fetches += (float)plan.pre_w * plan.pre_h;
+  }
+  if (mode == output_downscale::area) {
+    plan.filter = area_kernel(rx, ry);
+    plan.fetches += out_px * kernel_fetches(plan.filter);
+  } else {
+    plan.h_w = dst_w;
+    plan.h_h = rows;
+    plan.h_filter = lanczos_kernel(rx, true);
+    plan.filter = lanczos_kernel(ry, false);
+    plan.fetches += (float)plan.h_w * plan.h_h * kernel_fetches(plan.h_filter) +
+                    out_px * kernel_fetches(plan.filter);
+  }
+  return plan;
+}
+
+#ifndef GL_RED_EXT
+#define GL_RED_EXT 0x1903
+#endif
+
+// color renderability of a texture format is up to the driver in GLES2
+static bool renderable(GLenum format, GLenum type) {
+  GLuint tex, fb;
+  glGenTextures(1, &tex);
+  glBindTexture(GL_TEXTURE_2D, tex);
+  glTexImage2D(GL_TEXTURE_2D, 0, format, 1, 1, 0, format, type, nullptr);
+  glGenFramebuffers(1, &fb);
+  glBindFramebuffer(GL_FRAMEBUFFER, fb);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                         tex, 0);
+  bool ok = glCheckFramebufferStatus(GL_FRAMEBUFFER) ==
+            GL_FRAMEBUFFER_COMPLETE;
+  glDeleteFramebuffers(1, &fb);
+  glDeleteTextures(1, &tex);
+  gl_state_invalidate();
+  if (!ok)
+    printf("Intermediate format 0x%x type 0x%x is not renderable, "
+           "using RGBA8888\n",
+           format, type);
+  return ok;
+}
+
+graph_texture_desc intermediate_desc(output_intermediates policy, int w,
+                                     int h) {
+  graph_texture_desc desc;
+  desc.w = w;
+  desc.h = h;
+  if (policy == output_intermediates::fast) {
+    static const bool rgb565 = renderable(GL_RGB, GL_UNSIGNED_SHORT_5_6_5);
+    if (rgb565) {
+      desc.format = GL_RGB;
+      desc.type = GL_UNSIGNED_SHORT_5_6_5;
+    }
+  } else if (policy == output_intermediates::luma &&
+             gl_has_extension("GL_EXT_texture_rg")) {
+    static const bool r8 = renderable(GL_RED_EXT, GL_UNSIGNED_BYTE);
+    if (r8)
+      desc.format = GL_RED_EXT;
+  }
+  return desc;
+}
+
+const char *intermediate_format_name(const graph_texture_desc &desc) {
+  if (desc.type == GL_UNSIGNED_SHORT_5_6_5)
+    return "RGB565";
+  if (desc.format == GL_RED_EXT)
+    return "R8";
+  return "RGBA8888";
+}
+
+double intermediate_bytes_saved(const downscale_plan &plan,
+                                output_intermediates policy) {
+  int bytes = 4;
+  auto desc = intermediate_desc(policy, 1, 1);
+  if (desc.type == GL_UNSIGNED_SHORT_5_6_5)
+    bytes = 2;
+  else if (desc.format == GL_RED_EXT)
+    bytes = 1;
+  double px = (double)plan.pre_w * plan.pre_h + (double)plan.h_w * plan.h_h;
+  return px * (4 - bytes) * 2;
+}
+
+struct bench_target {
+  GLuint tex = 0, fb = 0;
+};
+
+static bench_target create_bench_target(int w, int h, const void *pixels) {
+  bench_target t;
+  GL_CHECK(glGenTextures(1, &t.tex));
+  GL_CHECK(glBindTexture(GL_TEXTURE_2D, t.tex));
+  GL_CHECK(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA,
+                        GL_UNSIGNED_BYTE, pixels));
+  GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+  GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+  GL_CHECK(
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+  GL_CHECK(
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+  GL_CHECK(glGenFramebuffers(1, &t.fb));
+  GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, t.fb));
+  GL_CHECK(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                  GL_TEXTURE_2D, t.tex, 0));
+  return t;
+}
+
+// a full viewport draw of `filter` from a 2D texture
+static void add_bench_pass(render_graph &graph, const std::string &name,
+                           int in, int out, const std::string &filter,
+                           float texel_w, float texel_h, shader_input input,
+                           const char *defines) {
+  shader_variant variant;
+  variant.input = input;
+  variant.filter = filter;
+  variant.defines = defines;
+  GLuint prog = get_variant_program(variant);
+  GLint crop_loc = glGetUniformLocation(prog, "u_crop");
+  GLint texel_loc = glGetUniformLocation(prog, "u_texel");
+  add_graph_pass(graph, name, {in}, out, [=](const graph_pass_context &) {
+    gl_state_use_program(prog);
+    GL_CHECK(glUniform4f(crop_loc, 0, 0, 1, 1));
+    GL_CHECK(glUniform2f(texel_loc, texel_w, texel_h));
+    GL_CHECK(glDrawArrays(GL_TRIANGLES, 0, 6));
+  });
+}
+
+// the passes of `plan` from `src` to `dst`, like build_output_graph
+static bool build_bench_graph(render_graph &graph, const downscale_plan &plan,
+                              output_intermediates policy,
+                              const bench_target &src, int src_w, int src_h,
+                              const bench_target &dst, int dst_w, int dst_h) {
+  int in = import_graph_texture(graph, "zone_plate");
+  bind_graph_texture(graph, in, src.tex);
+  int out = import_graph_target(graph, "out");
+  bind_graph_target(graph, out, dst.fb, dst_w, dst_h);
+  float texel_w = 1.0f / src_w, texel_h = 1.0f / src_h;
+  bool luma = policy == output_intermediates::luma;
+  const char *write_defines = luma ? "#define OUTPUT_Y\n" : "";
+  shader_input input = shader_input::tex2d;
+  if (plan.prescale) {
+    int pre = create_graph_texture(
+        graph, "pre", intermediate_desc(policy, plan.pre_w, plan.pre_h));
+    add_bench_pass(graph, "pre", in, pre, "bilinear", texel_w, texel_h,
+                   input, write_defines);
+    in = pre;
+    texel_w = 1.0f / plan.pre_w;
+    texel_h = 1.0f / plan.pre_h;
+    input = luma ? shader_input::luma2d : shader_input::tex2d;
+  }
+  if (!plan.h_filter.empty()) {
+    int h = create_graph_texture(graph, "h",
+                                 intermediate_desc(policy, plan.h_w, plan.h_h));
+    add_bench_pass(graph, "h", in, h, plan.h_filter, texel_w, texel_h, input,
+                   write_defines);
+    in = h;
+    texel_w = 1.0f / plan.h_w;
+    texel_h = 1.0f / plan.h_h;
+    input = luma ? shader_input::luma2d : shader_input::tex2d;
+  }
+  add_bench_pass(graph, "out", in, out, plan.filter, texel_w, texel_h, input,
+                 "");
+  return compile_render_graph(graph);
+}
+
+static std::vector<uint8_t> read_bench_target(const bench_target &t, int w,
+                                              int h) {
+  std::vector<uint8_t> pixels(w * h * 4);
+  gl_state_bind_framebuffer(t.fb);
+  GL_CHECK(glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE,
+                        pixels.data()));
+  return pixels;
+}
+
+/*
+ * Golden image check of the intermediate policies: the Lanczos chain with
+ * RGBA8888 intermediates is the reference. RGB565 rounds to 5 bits per
+ * stage, the R8 luma path keeps 8 bits of the gray zone plate.
+ */
+static bool check_intermediate_policies(const bench_target &src, int src_w,
+                                        int src_h, const bench_target &dst,
+                                        int dst_w, int dst_h) {
+  struct policy_check {
+    output_intermediates policy;
+    const char *name;
+    // tolerated deviation from the reference in 8 bit steps
+    float max_rms, max_err;
+  };
+  const policy_check checks[] = {
+      {output_intermediates::exact, "exact", 0, 0},
+      // two 5 bit roundings of +-4, the Lanczos lobes amplify them
+      {output_intermediates::fast, "fast", 3, 16},
+      {output_intermediates::luma, "luma", 1, 3},
+  };
+  auto plan = plan_downscale(output_downscale::lanczos, src_w, src_h, dst_w,
+                             dst_h);
+  printf("Intermediates of the lanczos chain:\n");
+  printf("  %-8s %-9s %9s %8s %8s\n", "policy", "format", "saved MB",
+         "rms", "max");
+  std::vector<uint8_t> reference;
+  bool all_ok = true;
+  for (auto &check : checks) {
+    render_graph graph;
+    if (!build_bench_graph(graph, plan, check.policy, src, src_w, src_h, dst,
+                           dst_w, dst_h)) {
+      printf("  %-8s failed to build\n", check.name);
+      all_ok = false;
+      continue;
+    }
+    execute_render_graph(graph);
+    auto result = read_bench_target(dst, dst_w, dst_h);
+    destroy_render_graph(graph);
+    if (reference.empty())
+      reference = result;
+    double sum = 0;
+    int max_err = 0;
+    for (size_t i = 0; i < result.size(); i += 4) {
+      int d = std::abs(result[i] - reference[i]);
+      sum += d * d;
+      max_err = std::max(max_err, d);
+    }
+    double rms = std::sqrt(sum / (result.size() / 4));
+    bool ok = rms <= check.max_rms && max_err <= check.max_err;
+    printf("  %-8s %-9s %9.2f %8.3f %8d %s\n", check.name,
+           intermediate_format_name(intermediate_desc(check.policy, 1, 1)),
+           intermediate_bytes_saved(plan, check.policy) / 1048576, rms,
+           max_err, ok ? "ok" : "OUT OF TOLERANCE");
+    all_ok = all_ok && ok;
+  }
+  return all_ok;
+}
+
+bool benchmark_downscale(int src_w, int src_h, int dst_w, int dst_h,
+                         int iterations) {
+  // zone plate, the local frequency grows linearly to the source Nyquist
+  // frequency in the corners
+  std::vector<uint8_t> pixels(src_w * src_h * 4);
+  float cx = src_w / 2.0f, cy = src_h / 2.0f;
+  float r_max = std::sqrt(cx * cx + cy * cy);
+  float k = M_PI * 0.5f / r_max;
+  for (int y = 0; y < src_h; y++) {
+    for (int x = 0; x < src_w; x++) {
+      float dx = x + 0.5f - cx, dy = y + 0.5f - cy;
+      float v = 0.5f + 0.5f * std::cos(k * (dx * dx + dy * dy));
+      uint8_t *p = &pixels[(y * src_w + x) * 4];
+      p[0] = p[1] = p[2] = std::lround(v * 255);
+      p[3] = 255;
+    }
+  }
+  bench_target src = create_bench_target(src_w, src_h, pixels.data());
+  bench_target dst = create_bench_target(dst_w, dst_h, nullptr);
+  // output Nyquist in cycles per source pixel
+  float ratio = std::max((float)src_w / dst_w, (float)src_h / dst_h);
+  float nyquist = 0.5f / ratio;
+
+  printf("Downscale %dx%d -> %dx%d\n", src_w, src_h, dst_w, dst_h);
+  // fetches per output pixel, intermediates included
+  printf("  %-8s %9s %8s %10s %10s %9s\n", "mode", "ms/frame", "fetches",
+         "alias rms", "pass rms", "MB/frame");
+  const output_downscale modes[] = {output_downscale::none,
+                                    output_downscale::area,
+                                    output_downscale::lanczos};
+  const char *names[] = {"sharpen", "area", "lanczos"};
+  for (int m = 0; m < 3; m++) {
+    auto plan = plan_downscale(modes[m], src_w, src_h, dst_w, dst_h);
+    render_graph graph;
+    if (!build_bench_graph(graph, plan, output_intermediates::exact, src,
+                           src_w, src_h, dst, dst_w, dst_h))
+      continue;
+
+    // the first run includes shader compilation
+    execute_render_graph(graph);
+    glFinish();
+    auto t0 = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < iterations; i++)
+      execute_render_graph(graph);
+    glFinish();
+    auto t1 = std::chrono::high_resolution_clock::now();
+    double ms =
+        std::chrono::duration<double>(t1 - t0).count() * 1000 / iterations;
+
+    auto result = read_bench_target(dst, dst_w, dst_h);
+    double alias = 0, pass = 0;
+    int alias_n = 0, pass_n = 0;
+    for (int y = 0; y < dst_h; y++) {
+      for (int x = 0; x < dst_w; x++) {
+        float sx = (x + 0.5f) * src_w / dst_w - cx;
+        float sy = (y + 0.5f) * src_h / dst_h - cy;
+        float r = std::sqrt(sx * sx + sy * sy);
+        float freq = k * r / M_PI;
+        float v = result[(y * dst_w + x) * 4] / 255.0f;
+        if (freq > 1.25f * nyquist) {
+          // anything but flat gray is aliasing
+          alias += (v - 0.5f) * (v - 0.5f);
+          alias_n++;
+        } else if (freq < 0.5f * nyquist) {
+          float ref = 0.5f + 0.5f * std::cos(k * r * r);
+          pass += (v - ref) * (v - ref);
+          pass_n++;
+        }
+      }
+    }
+    // render target traffic, the texture fetches come on top
+    printf("  %-8s %9.3f %8.2f %10.4f %10.4f %9.2f\n", names[m], ms,
+           plan.fetches / (dst_w * dst_h),
+           alias_n ? std::sqrt(alias / alias_n) : 0.0,
+           pass_n ? std::sqrt(pass / pass_n) : 0.0,
+           get_render_graph_traffic(graph).bytes / 1048576);
+    destroy_render_graph(graph);
+  }
+  bool ok = check_intermediate_policies(src, src_w, src_h, dst, dst_w, dst_h);
+  print_gl_state_stats();
+  gl_state_bind_framebuffer(0);
+  glDeleteFramebuffers(1, &src.fb);
+  glDeleteFramebuffers(1, &dst.fb);
+  glDeleteTextures(1, &src.tex);
+  glDeleteTextures(1, &dst.tex);
+  return ok;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "output_spec.hpp"
+#include <string>
+
+/*
+ * Passes reducing a `src_w` x `src_h` region to `dst_w` x `dst_h`. A single
+ * pass needs more fetches the larger the ratio, past a limit a 2x box
+ * prefilter (one bilinear fetch between 2x2 texels) halves the ratio
+ * first. There are at most two steps and the taps per axis are capped, so
+ * very large ratios get a coarser kernel instead of an unbounded fetch
+ * count.
+ */
+struct downscale_plan {
+  output_downscale mode = output_downscale::none;
+  bool prescale = false;
+  int pre_w = 0, pre_h = 0;
+  // intermediate of the horizontal Lanczos pass, 0 without one
+  int h_w = 0, h_h = 0;
+  // kernels of the horizontal pass and of the final (output) pass
+  std::string h_filter;
+  std::string filter = "sharpen";
+  // texel fetches per frame, intermediates included
+  float fetches = 0;
+};
+
+/* Registers the kernels of the plan, see resample_filter.hpp */
+downscale_plan plan_downscale(output_downscale mode, int src_w, int src_h,
+                              int dst_w, int dst_h);
+
+/*
+ * Target of a `w` x `h` intermediate under `policy`. R8 needs
+ * GL_EXT_texture_rg, without it luma is kept in an RGBA8888 target.
+ * RGB565 and R8 also fall back to RGBA8888 when the driver can't render
+ * to them, checked once on the first call.
+ */
+graph_texture_desc intermediate_desc(output_intermediates policy, int w,
+                                     int h);
+const char *intermediate_format_name(const graph_texture_desc &desc);
+/*
+ * DRAM bytes per frame the intermediates of `plan` save against RGBA8888,
+ * counting one write and one read of each.
+ */
+double intermediate_bytes_saved(const downscale_plan &plan,
+                                output_intermediates policy);
+
+/*
+ * Renders a zone plate from `src_w` x `src_h` to `dst_w` x `dst_h` with
+ * every mode and prints the GPU time per frame, the fetches per pixel and
+ * the aliasing: RMS deviation from flat gray where the pattern is above
+ * the output Nyquist frequency, next to the error where it is well below.
+ * Then compares the Lanczos chain with every intermediate policy against
+ * the exact one and checks the deviation against per policy tolerances,
+ * false when a policy is out of tolerance or fails to build.
+ */
+bool benchmark_downscale(int src_w, int src_h, int dst_w, int dst_h,
+                         int iterations);
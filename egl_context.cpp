@@ -0,0 +1,137 @@
+#include "egl_context.hpp"
+#include "common.h"
+#include <stdio.h>
+#include <string.h>
+
+typedef EGLDisplay(EGLAPIENTRYP PFNEGLGETPLATFORMDISPLAYEXTPROC)(
+    EGLenum platform, void *native_display, const EGLint *attrib_list);
+
+static const EGLint configAttribs[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+                                       EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+                                       EGL_NONE};
+// EGL_SURFACE_TYPE defaults to EGL_WINDOW_BIT, 0 drops the surface filter
+static const EGLint surfacelessConfigAttribs[] = {
+    EGL_SURFACE_TYPE, 0, EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT, EGL_NONE,
+};
+static const EGLint pbufferAttribs[] = {
+    EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE,
+};
+
+bool egl_has_extension(EGLDisplay disp, const char *name) {
+  const char *exts = eglQueryString(disp, EGL_EXTENSIONS);
+  if (exts == nullptr)
+    return false;
+  size_t len = strlen(name);
+  for (const char *p = strstr(exts, name); p; p = strstr(p + len, name)) {
+    if ((p == exts || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0'))
+      return true;
+  }
+  return false;
+}
+
+EGLDisplay get_egl_display() {
+  // client extensions, fails with EGL_BAD_DISPLAY on plain EGL 1.4
+  if (egl_has_extension(EGL_NO_DISPLAY, "EGL_EXT_platform_base") &&
+      egl_has_extension(EGL_NO_DISPLAY, "EGL_MESA_platform_surfaceless")) {
+    auto get_platform_display =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress(
+            "eglGetPlatformDisplayEXT");
+    if (get_platform_display) {
+      EGLDisplay disp = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                             EGL_DEFAULT_DISPLAY, nullptr);
+      if (disp != EGL_NO_DISPLAY) {
+        printf("Using surfaceless platform\n");
+        return disp;
+      }
+    }
+  }
+  eglGetError();
+  return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+/*
+ * EGL_KHR_surfaceless_context only allows binding without a surface, the
+ * client API must also expose GL_OES_surfaceless_context to render that way.
+ * The context is made current once to check, then the previous one restored.
+ */
+static bool gl_surfaceless_supported(EGLDisplay disp, EGLContext ctx) {
+  EGLDisplay prev_disp = eglGetCurrentDisplay();
+  EGLContext prev_ctx = eglGetCurrentContext();
+  EGLSurface prev_draw = eglGetCurrentSurface(EGL_DRAW);
+  EGLSurface prev_read = eglGetCurrentSurface(EGL_READ);
+  if (!eglMakeCurrent(disp, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx))
+    return false;
+  // the first context is created before main loads the GLES entry points
+  if (glad_glGetString == nullptr)
+    gladLoaderLoadGLES2();
+  bool ok = glad_glGetString != nullptr &&
+            gl_has_extension("GL_OES_surfaceless_context");
+  if (prev_ctx != EGL_NO_CONTEXT)
+    eglMakeCurrent(prev_disp, prev_draw, prev_read, prev_ctx);
+  else
+    eglMakeCurrent(disp, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  return ok;
+}
+
+static egl_context create_egl_context(EGLDisplay disp, EGLContext share,
+                                      bool surfaceless) {
+  egl_context out;
+  out.disp = disp;
+  EGLint numConfigs;
+  const EGLint *attribs = surfaceless ? surfacelessConfigAttribs
+                                      : configAttribs;
+  if (!eglChooseConfig(disp, attribs, &out.cfg, 1, &numConfigs) ||
+      numConfigs < 1) {
+    printf("eglChooseConfig failed %i\n", eglGetError());
+    return {};
+  }
+  if (!eglBindAPI(EGL_OPENGL_ES_API)) {
+    printf("eglBindAPI failed %i\n", eglGetError());
+    return {};
+  }
+  EGLint ctx_attribs[] = {EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE};
+  out.ctx = eglCreateContext(disp, out.cfg, share, ctx_attribs);
+  if (out.ctx == EGL_NO_CONTEXT) {
+    printf("eglCreateContext failed %i\n", eglGetError());
+    return {};
+  }
+  if (surfaceless) {
+    if (gl_surfaceless_supported(disp, out.ctx))
+      return out;
+    printf("GL_OES_surfaceless_context missing, using a pbuffer\n");
+    eglDestroyContext(disp, out.ctx);
+    return create_egl_context(disp, share, false);
+  }
+  out.surf = eglCreatePbufferSurface(disp, out.cfg, pbufferAttribs);
+  if (out.surf == EGL_NO_SURFACE) {
+    printf("eglCreatePbufferSurface failed %i\n", eglGetError());
+    eglDestroyContext(disp, out.ctx);
+    return {};
+  }
+  return out;
+}
+
+egl_context create_egl_context(EGLDisplay disp, EGLContext share) {
+  return create_egl_context(
+      disp, share, egl_has_extension(disp, "EGL_KHR_surfaceless_context"));
+}
+
+bool make_current(const egl_context &ctx) {
+  if (!eglMakeCurrent(ctx.disp, ctx.surf, ctx.surf, ctx.ctx)) {
+    printf("eglMakeCurrent failed %i\n", eglGetError());
+    return false;
+  }
+  return true;
+}
+
+void destroy_egl_context(egl_context &ctx) {
+  if (ctx.disp == EGL_NO_DISPLAY)
+    return;
+  if (eglGetCurrentContext() == ctx.ctx)
+    eglMakeCurrent(ctx.disp, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  if (ctx.surf != EGL_NO_SURFACE)
+    eglDestroySurface(ctx.disp, ctx.surf);
+  if (ctx.ctx != EGL_NO_CONTEXT)
+    eglDestroyContext(ctx.disp, ctx.ctx);
+  ctx = {};
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "glad/egl.h"
+
+#ifndef EGL_MESA_platform_surfaceless
+#define EGL_MESA_platform_surfaceless 1
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+struct egl_context {
+  EGLDisplay disp = EGL_NO_DISPLAY;
+  EGLConfig cfg = nullptr;
+  EGLContext ctx = EGL_NO_CONTEXT;
+  // only allocated when surfaceless contexts are not supported
+  EGLSurface surf = EGL_NO_SURFACE;
+};
+
+bool egl_has_extension(EGLDisplay disp, const char *name);
+
+/*
+ * Returns the EGL_MESA_platform_surfaceless display when the client
+ * extensions expose it, the default display otherwise.
+ */
+EGLDisplay get_egl_display();
+
+/*
+ * Creates a GLES2 context. All rendering goes to dmabuf backed FBOs, so the
+ * context is made current without a surface when EGL_KHR_surfaceless_context
+ * and GL_OES_surfaceless_context are available and with a 1x1 pbuffer
+ * otherwise.
+ */
+egl_context create_egl_context(EGLDisplay disp,
+                               EGLContext share = EGL_NO_CONTEXT);
+bool make_current(const egl_context &ctx);
+void destroy_egl_context(egl_context &ctx);
@@ -0,0 +1,95 @@
+#include "egl_sync.hpp"
+#include "egl_context.hpp"
+#include "glad/gles2.h"
+#include <errno.h>
+#include <linux/dma-buf.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+typedef EGLint(EGLAPIENTRYP PFNEGLDUPNATIVEFENCEFDANDROIDPROC)(
+    EGLDisplay dpy, EGLSyncKHR sync);
+
+static PFNEGLDUPNATIVEFENCEFDANDROIDPROC dup_native_fence_fd = nullptr;
+
+bool egl_sync_init(EGLDisplay disp) {
+  if (!GLAD_EGL_KHR_fence_sync) {
+    printf("EGL_KHR_fence_sync not supported\n");
+    return false;
+  }
+  if (egl_has_extension(disp, "EGL_ANDROID_native_fence_sync")) {
+    dup_native_fence_fd = (PFNEGLDUPNATIVEFENCEFDANDROIDPROC)eglGetProcAddress(
+        "eglDupNativeFenceFDANDROID");
+  }
+  printf("Native fence sync: %s\n", dup_native_fence_fd ? "yes" : "no");
+  return true;
+}
+
+bool egl_has_native_fence() { return dup_native_fence_fd != nullptr; }
+
+int export_dmabuf_fence(int dma_fd) {
+  struct dma_buf_export_sync_file req = {0};
+  req.flags = DMA_BUF_SYNC_WRITE;
+  req.fd = -1;
+  do {
+    if (ioctl(dma_fd, DMA_BUF_IOCTL_EXPORT_SYNC_FILE, &req) == 0)
+      return req.fd;
+  } while ((errno == EINTR) || (errno == EAGAIN));
+  return -1;
+}
+
+egl_frame_fence create_frame_fence(EGLDisplay disp, int dma_fd) {
+  egl_frame_fence fence;
+  if (dup_native_fence_fd) {
+    EGLint attribs[] = {EGL_SYNC_NATIVE_FENCE_FD_ANDROID,
+                        EGL_NO_NATIVE_FENCE_FD_ANDROID, EGL_NONE};
+    fence.sync =
+        eglCreateSyncKHR(disp, EGL_SYNC_NATIVE_FENCE_ANDROID, attribs);
+    // the native fence only materializes once the commands are flushed
+    glFlush();
+    if (fence.sync != EGL_NO_SYNC_KHR) {
+      fence.fd = dup_native_fence_fd(disp, fence.sync);
+      if (fence.fd == EGL_NO_NATIVE_FENCE_FD_ANDROID)
+        printf("eglDupNativeFenceFDANDROID failed %i\n", eglGetError());
+      return fence;
+    }
+  }
+  fence.sync = eglCreateSyncKHR(disp, EGL_SYNC_FENCE_KHR, nullptr);
+  if (fence.sync == EGL_NO_SYNC_KHR) {
+    printf("eglCreateSyncKHR failed %i\n", eglGetError());
+  }
+  glFlush();
+  if (dma_fd >= 0)
+    fence.fd = export_dmabuf_fence(dma_fd);
+  return fence;
+}
+
+bool wait_frame_fence(EGLDisplay disp, const egl_frame_fence &fence,
+                      EGLTimeKHR timeout) {
+  if (fence.sync == EGL_NO_SYNC_KHR)
+    return wait_fence_fd(fence.fd);
+  EGLint ret = eglClientWaitSyncKHR(disp, fence.sync,
+                                    EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, timeout);
+  return ret == EGL_CONDITION_SATISFIED_KHR;
+}
+
+void destroy_frame_fence(EGLDisplay disp, egl_frame_fence &fence) {
+  if (fence.sync != EGL_NO_SYNC_KHR)
+    eglDestroySyncKHR(disp, fence.sync);
+  if (fence.fd >= 0)
+    close(fence.fd);
+  fence = {};
+}
+
+bool wait_fence_fd(int fd, int timeout_ms) {
+  if (fd < 0)
+    return false;
+  struct pollfd pfd = {fd, POLLIN, 0};
+  int ret;
+  do {
+    ret = poll(&pfd, 1, timeout_ms);
+  } while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+  return ret > 0;
+}
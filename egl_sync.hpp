@@ -0,0 +1,42 @@
+#pragma once
+
+#include "glad/egl.h"
+
+#ifndef EGL_ANDROID_native_fence_sync
+#define EGL_ANDROID_native_fence_sync 1
+#define EGL_SYNC_NATIVE_FENCE_ANDROID 0x3144
+#define EGL_SYNC_NATIVE_FENCE_FD_ANDROID 0x3145
+#define EGL_SYNC_NATIVE_FENCE_SIGNALED_ANDROID 0x3146
+#define EGL_NO_NATIVE_FENCE_FD_ANDROID -1
+#endif
+
+/*
+ * A fence marking the end of the GPU work that writes a frame.
+ * `fd` is a sync_file: consumers can poll() it for POLLIN or hand it to
+ * their own driver. The fd stays owned by the frame, consumers should dup()
+ * it if they need it past the next reuse of the frame.
+ */
+struct egl_frame_fence {
+  EGLSyncKHR sync = EGL_NO_SYNC_KHR;
+  int fd = -1;
+};
+
+/* Loads EGL_ANDROID_native_fence_sync if the display exposes it. */
+bool egl_sync_init(EGLDisplay disp);
+bool egl_has_native_fence();
+
+/*
+ * Inserts a fence after all GL commands issued so far and flushes them.
+ * With EGL_ANDROID_native_fence_sync the fence is exported directly,
+ * otherwise the implicit write fence of `dma_fd` is exported through
+ * DMA_BUF_IOCTL_EXPORT_SYNC_FILE. `fd` stays -1 if neither works.
+ */
+egl_frame_fence create_frame_fence(EGLDisplay disp, int dma_fd);
+/* Exports the implicit write fence of a dmabuf as a sync_file, -1 on error */
+int export_dmabuf_fence(int dma_fd);
+/* Blocks until the fence signaled, returns false on timeout or error. */
+bool wait_frame_fence(EGLDisplay disp, const egl_frame_fence &fence,
+                      EGLTimeKHR timeout = EGL_FOREVER_KHR);
+void destroy_frame_fence(EGLDisplay disp, egl_frame_fence &fence);
+/* Consumer side wait on a sync_file, timeout in ms (-1 = forever). */
+bool wait_fence_fd(int fd, int timeout_ms = -1);
@@ -0,0 +1,172 @@
+#include "fp16_output.hpp"
+#include "common.h"
+#include "gl_state.hpp"
+#include "output_spec.hpp"
+#include "v4l2_device.hpp"
+#include <drm/drm_fourcc.h>
+#include <string.h>
+#include <vector>
+
+static fp16_caps caps;
+
+// one render and read attempt on a 4x4 ABGR16161616F dmabuf
+static bool probe_dmabuf_render(EGLDisplay disp, int dma_heap_fd) {
+  const int w = 4, h = 4;
+  int fd = dmabuf_heap_alloc(dma_heap_fd, NULL, w * h * 8);
+  if (fd < 0)
+    return false;
+  EGLImage img = create_abgr16f_drm(w, h, fd, disp, 0);
+  bool ok = false;
+  if (img != EGL_NO_IMAGE_KHR) {
+    GLuint rb, fb;
+    glGenRenderbuffers(1, &rb);
+    glBindRenderbuffer(GL_RENDERBUFFER, rb);
+    glEGLImageTargetRenderbufferStorageOES(GL_RENDERBUFFER, img);
+    glGenFramebuffers(1, &fb);
+    glBindFramebuffer(GL_FRAMEBUFFER, fb);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_RENDERBUFFER, rb);
+    ok = glGetError() == GL_NO_ERROR &&
+         glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fb);
+    glDeleteRenderbuffers(1, &rb);
+    eglDestroyImageKHR(disp, img);
+  }
+  close(fd);
+  return ok;
+}
+
+// whether a half float FBO renders and reads back as GL_HALF_FLOAT_OES
+static bool probe_read_half(bool &renderable) {
+  GLuint tex, fb;
+  glGenTextures(1, &tex);
+  glBindTexture(GL_TEXTURE_2D, tex);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 4, 4, 0, GL_RGBA, GL_HALF_FLOAT_OES,
+               nullptr);
+  glGenFramebuffers(1, &fb);
+  glBindFramebuffer(GL_FRAMEBUFFER, fb);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                         tex, 0);
+  renderable = glGetError() == GL_NO_ERROR &&
+               glCheckFramebufferStatus(GL_FRAMEBUFFER) ==
+                   GL_FRAMEBUFFER_COMPLETE;
+  GLint read_type = 0, read_fmt = 0;
+  if (renderable) {
+    glGetIntegerv(GL_IMPLEMENTATION_COLOR_READ_TYPE, &read_type);
+    glGetIntegerv(GL_IMPLEMENTATION_COLOR_READ_FORMAT, &read_fmt);
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glDeleteFramebuffers(1, &fb);
+  glDeleteTextures(1, &tex);
+  glGetError();
+  return read_type == GL_HALF_FLOAT_OES && read_fmt == GL_RGBA;
+}
+
+const fp16_caps &detect_fp16_caps(EGLDisplay disp, int dma_heap_fd) {
+  caps = {};
+  caps.texture_half_float = gl_has_extension("GL_OES_texture_half_float");
+  caps.color_buffer_half_float =
+      gl_has_extension("GL_EXT_color_buffer_half_float");
+  if (caps.color_buffer_half_float && dma_heap_fd >= 0)
+    caps.dmabuf_render = probe_dmabuf_render(disp, dma_heap_fd);
+  if (caps.texture_half_float) {
+    bool renderable = false;
+    caps.read_half = probe_read_half(renderable);
+    caps.color_buffer_half_float &= renderable;
+  }
+
+  if (caps.dmabuf_render)
+    caps.mode = fp16_mode::dmabuf;
+  else if (caps.color_buffer_half_float && caps.read_half)
+    caps.mode = fp16_mode::readback;
+  else
+    caps.mode = fp16_mode::cpu;
+  static const char *names[] = {"dmabuf", "readback", "cpu"};
+  printf("fp16 outputs: %s\n", names[(int)caps.mode]);
+  return caps;
+}
+
+fp16_mode get_fp16_mode() { return caps.mode; }
+
+uint16_t float_to_half(float f) {
+  uint32_t x;
+  memcpy(&x, &f, 4);
+  uint32_t sign = (x >> 16) & 0x8000;
+  int32_t exp = ((x >> 23) & 0xff) - 127 + 15;
+  uint32_t mant = x & 0x7fffff;
+  if (((x >> 23) & 0xff) == 0xff)
+    return sign | 0x7c00 | (mant ? 0x200 : 0);
+  if (exp >= 31)
+    return sign | 0x7c00;
+  if (exp <= 0) {
+    if (exp < -10)
+      return sign;
+    // subnormal, round to nearest
+    mant |= 0x800000;
+    uint32_t shift = 14 - exp;
+    return sign | ((mant + (1u << (shift - 1))) >> shift);
+  }
+  // round to nearest, a carry into the exponent is the right result
+  return (sign | (exp << 10) | (mant >> 13)) + ((mant >> 12) & 1);
+}
+
+float half_to_float(uint16_t h) {
+  uint32_t sign = (h & 0x8000u) << 16;
+  uint32_t exp = (h >> 10) & 0x1f;
+  uint32_t mant = h & 0x3ff;
+  uint32_t x;
+  if (exp == 0x1f) {
+    x = sign | 0x7f800000 | (mant << 13);
+  } else if (exp != 0) {
+    x = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+  } else if (mant == 0) {
+    x = sign;
+  } else {
+    // subnormal, normalize the mantissa
+    exp = 127 - 15 + 1;
+    while (!(mant & 0x400)) {
+      mant <<= 1;
+      exp--;
+    }
+    x = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+  }
+  float f;
+  memcpy(&f, &x, 4);
+  return f;
+}
+
+bool read_back_fp16(const egl_dma_frame &frame, const output_norm &norm) {
+  if (caps.mode == fp16_mode::dmabuf)
+    return true;
+  if (frame.map == nullptr)
+    return false;
+  gl_state_bind_framebuffer(frame.fb);
+  dmabuf_sync_start(frame.fd);
+  bool ok;
+  if (caps.mode == fp16_mode::readback) {
+    ok = GL_VERIFY(glReadPixels(0, 0, frame.w, frame.h, GL_RGBA,
+                                GL_HALF_FLOAT_OES, frame.map));
+  } else {
+    std::vector<uint8_t> rgba(frame.w * frame.h * 4);
+    ok = GL_VERIFY(glReadPixels(0, 0, frame.w, frame.h, GL_RGBA,
+                                GL_UNSIGNED_BYTE, rgba.data()));
+    float a[3] = {1, 1, 1}, b[3] = {0, 0, 0};
+    if (norm.enabled) {
+      for (int c = 0; c < 3; c++) {
+        a[c] = 1.0f / (255.0f * norm.std[c]);
+        b[c] = -norm.mean[c] / norm.std[c];
+      }
+    } else {
+      a[0] = a[1] = a[2] = 1.0f / 255.0f;
+    }
+    auto *out = (uint16_t *)frame.map;
+    for (size_t i = 0; i < rgba.size(); i += 4) {
+      for (int c = 0; c < 3; c++)
+        out[i + c] = float_to_half(rgba[i + c] * a[c] + b[c]);
+      out[i + 3] = float_to_half(1.0f);
+    }
+  }
+  dmabuf_sync_stop(frame.fd);
+  return ok;
+}
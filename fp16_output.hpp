@@ -0,0 +1,50 @@
+#pragma once
+
+#include "glad/egl.h"
+#include "glad/gles2.h"
+#include <stdint.h>
+
+#ifndef GL_HALF_FLOAT_OES
+#define GL_HALF_FLOAT_OES 0x8D61
+#endif
+
+struct egl_dma_frame;
+struct output_norm;
+
+// how DRM_FORMAT_ABGR16161616F outputs are produced, best first
+enum class fp16_mode {
+  // render straight into the half float dmabuf
+  dmabuf,
+  // render into a half float texture, glReadPixels into the dmabuf
+  readback,
+  // render 8 bit RGB, normalize and convert to half floats on the CPU
+  cpu,
+};
+
+struct fp16_caps {
+  // GL_OES_texture_half_float
+  bool texture_half_float = false;
+  // GL_EXT_color_buffer_half_float
+  bool color_buffer_half_float = false;
+  // ABGR16161616F dmabufs import as complete render targets
+  bool dmabuf_render = false;
+  // the half float FBO can be read back without conversion
+  bool read_half = false;
+  fp16_mode mode = fp16_mode::cpu;
+};
+
+/*
+ * Probes the half float support once at startup and picks the mode all
+ * fp16 outputs use. Needs a current context.
+ */
+const fp16_caps &detect_fp16_caps(EGLDisplay disp, int dma_heap_fd);
+fp16_mode get_fp16_mode();
+
+uint16_t float_to_half(float f);
+float half_to_float(uint16_t h);
+
+/*
+ * Copies a rendered fp16 frame into its dmabuf for the readback and cpu
+ * modes, a no-op for dmabuf mode. Blocks until the GPU finished the frame.
+ */
+bool read_back_fp16(const egl_dma_frame &frame, const output_norm &norm);
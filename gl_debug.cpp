@@ -0,0 +1,87 @@
+#include "gl_debug.hpp"
+#include "glad/gles2.h"
+#include <deque>
+#include <mutex>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string>
+
+// bounds the memory of a driver spamming messages
+static const size_t max_messages = 256;
+
+static std::mutex log_mutex;
+static std::deque<std::string> messages;
+static unsigned long dropped = 0;
+
+static void push_message(std::string msg) {
+  std::lock_guard<std::mutex> lock(log_mutex);
+  if (messages.size() >= max_messages) {
+    dropped++;
+    return;
+  }
+  messages.push_back(std::move(msg));
+}
+
+void gl_debug_log(const char *fmt, ...) {
+  char buf[512];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(buf, sizeof(buf), fmt, args);
+  va_end(args);
+  push_message(buf);
+}
+
+void flush_gl_debug_log() {
+  std::deque<std::string> out;
+  unsigned long lost;
+  {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    out.swap(messages);
+    lost = dropped;
+    dropped = 0;
+  }
+  for (auto &msg : out)
+    printf("%s\n", msg.c_str());
+  if (lost)
+    printf("%lu GL debug messages dropped\n", lost);
+}
+
+static void EGLAPIENTRY on_egl_message(EGLenum error, const char *command,
+                                       EGLint message_type,
+                                       EGLLabelKHR thread_label,
+                                       EGLLabelKHR object_label,
+                                       const char *message) {
+  gl_debug_log("EGL error 0x%x in %s: %s", error, command ? command : "?",
+               message ? message : "");
+}
+
+void gl_debug_init_egl() {
+  if (!GLAD_EGL_KHR_debug || !eglDebugMessageControlKHR)
+    return;
+  EGLAttrib controls[] = {
+      EGL_DEBUG_MSG_CRITICAL_KHR, EGL_TRUE, EGL_DEBUG_MSG_ERROR_KHR,
+      EGL_TRUE, EGL_DEBUG_MSG_WARN_KHR, EGL_TRUE, EGL_DEBUG_MSG_INFO_KHR,
+      EGL_FALSE, EGL_NONE,
+  };
+  eglDebugMessageControlKHR(&on_egl_message, controls);
+}
+
+static void GLAD_API_PTR on_gl_message(GLenum source, GLenum type, GLuint id,
+                                       GLenum severity, GLsizei length,
+                                       const GLchar *message,
+                                       const void *user) {
+  gl_debug_log("GL debug 0x%x (type 0x%x, severity 0x%x): %.*s", id, type,
+               severity, (int)length, message);
+}
+
+void gl_debug_init_gl() {
+  if (!GLAD_GL_KHR_debug || !glDebugMessageCallbackKHR)
+    return;
+  glDebugMessageCallbackKHR(&on_gl_message, nullptr);
+  // notifications are informational chatter, keep the rest
+  glDebugMessageControlKHR(GL_DONT_CARE, GL_DONT_CARE,
+                           GL_DEBUG_SEVERITY_NOTIFICATION_KHR, 0, nullptr,
+                           GL_FALSE);
+  glEnable(GL_DEBUG_OUTPUT_KHR);
+  printf("GL_KHR_debug callback installed\n");
+}
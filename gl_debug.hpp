@@ -0,0 +1,19 @@
+#pragma once
+
+#include "glad/egl.h"
+
+/*
+ * Diagnostics without console I/O on the frame path: GL_CHECK failures and
+ * EGL_KHR_debug / GL_KHR_debug messages are queued (the callbacks may run
+ * on driver threads) and printed by flush_gl_debug_log.
+ */
+void gl_debug_init_egl();
+// GL callback of the current context
+void gl_debug_init_gl();
+
+void gl_debug_log(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+// prints and clears the queued messages
+void flush_gl_debug_log();
+
+// every `interval`-th GL_CHECK queries glGetError with GL_CHECK_LEVEL 1
+void set_gl_check_interval(unsigned interval);
@@ -0,0 +1,220 @@
+#include "gl_state.hpp"
+#include "common.h"
+#include "shader.hpp"
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <unordered_map>
+
+#ifndef GL_TEXTURE_EXTERNAL_OES
+#define GL_TEXTURE_EXTERNAL_OES 0x8D65
+#endif
+
+static const int max_units = 8;
+static const int max_attribs = 4;
+// GL ids are never ~0u, marks unknown state
+static const GLuint unknown = ~0u;
+
+struct gl_vertex_attrib {
+  bool valid = false;
+  bool enabled;
+  GLint size;
+  GLenum type;
+  GLsizei stride;
+  GLuint offset;
+  GLuint buf;
+};
+
+struct gl_state_cache {
+  GLuint prog = unknown;
+  GLuint fb = unknown;
+  GLuint array_buf = unknown;
+  int active_unit = -1;
+  // [unit][0] GL_TEXTURE_2D, [unit][1] GL_TEXTURE_EXTERNAL_OES
+  GLuint textures[max_units][2];
+  std::unordered_map<GLuint, GLenum> filters;
+  bool viewport_valid = false;
+  int viewport[4];
+  // -1 unknown, else whether GL_SCISSOR_TEST is enabled
+  int scissor_test = -1;
+  bool scissor_valid = false;
+  int scissor[4];
+  bool clear_valid = false;
+  float clear[4];
+  gl_vertex_attrib attribs[max_attribs];
+  gl_state_stats stats;
+
+  gl_state_cache() { invalidate(); }
+  void invalidate() {
+    prog = fb = array_buf = unknown;
+    active_unit = -1;
+    for (auto &unit : textures)
+      unit[0] = unit[1] = unknown;
+    filters.clear();
+    viewport_valid = scissor_valid = clear_valid = false;
+    scissor_test = -1;
+    for (auto &attrib : attribs)
+      attrib.valid = false;
+  }
+};
+
+static thread_local gl_state_cache state;
+
+// counts `calls` GL calls as issued or elided
+static bool changed(bool differs, int calls = 1) {
+  (differs ? state.stats.issued : state.stats.elided) += calls;
+  return differs;
+}
+
+void gl_state_invalidate() { state.invalidate(); }
+
+void gl_state_use_program(GLuint prog) {
+  if (changed(state.prog != prog)) {
+    state.prog = prog;
+    GL_CHECK(glUseProgram(prog));
+  }
+}
+
+void gl_state_bind_framebuffer(GLuint fb) {
+  if (changed(state.fb != fb)) {
+    state.fb = fb;
+    GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, fb));
+  }
+}
+
+static void active_unit(int unit) {
+  if (changed(state.active_unit != unit)) {
+    state.active_unit = unit;
+    GL_CHECK(glActiveTexture(GL_TEXTURE0 + unit));
+  }
+}
+
+void gl_state_bind_texture(int unit, GLenum target, GLuint tex) {
+  int t = target == GL_TEXTURE_EXTERNAL_OES;
+  // units past the cache are always bound
+  GLuint *bound = unit < max_units ? &state.textures[unit][t] : nullptr;
+  if (changed(!bound || *bound != tex)) {
+    if (bound)
+      *bound = tex;
+    active_unit(unit);
+    GL_CHECK(glBindTexture(target, tex));
+  }
+}
+
+void gl_state_texture_filter(int unit, GLenum target, GLuint tex,
+                             GLenum filter) {
+  gl_state_bind_texture(unit, target, tex);
+  auto it = state.filters.find(tex);
+  if (changed(it == state.filters.end() || it->second != filter, 2)) {
+    state.filters[tex] = filter;
+    active_unit(unit);
+    GL_CHECK(glTexParameteri(target, GL_TEXTURE_MIN_FILTER, filter));
+    GL_CHECK(glTexParameteri(target, GL_TEXTURE_MAG_FILTER, filter));
+  }
+}
+
+void gl_state_viewport(int x, int y, int w, int h) {
+  int vp[4] = {x, y, w, h};
+  if (changed(!state.viewport_valid ||
+              memcmp(vp, state.viewport, sizeof(vp)) != 0)) {
+    state.viewport_valid = true;
+    memcpy(state.viewport, vp, sizeof(vp));
+    GL_CHECK(glViewport(x, y, w, h));
+  }
+}
+
+void gl_state_scissor(int x, int y, int w, int h) {
+  if (changed(state.scissor_test != 1)) {
+    state.scissor_test = 1;
+    GL_CHECK(glEnable(GL_SCISSOR_TEST));
+  }
+  int box[4] = {x, y, w, h};
+  if (changed(!state.scissor_valid ||
+              memcmp(box, state.scissor, sizeof(box)) != 0)) {
+    state.scissor_valid = true;
+    memcpy(state.scissor, box, sizeof(box));
+    GL_CHECK(glScissor(x, y, w, h));
+  }
+}
+
+void gl_state_disable_scissor() {
+  if (changed(state.scissor_test != 0)) {
+    state.scissor_test = 0;
+    GL_CHECK(glDisable(GL_SCISSOR_TEST));
+  }
+}
+
+void gl_state_clear_color(float r, float g, float b, float a) {
+  float c[4] = {r, g, b, a};
+  if (changed(!state.clear_valid || memcmp(c, state.clear, sizeof(c)) != 0)) {
+    state.clear_valid = true;
+    memcpy(state.clear, c, sizeof(c));
+    GL_CHECK(glClearColor(r, g, b, a));
+  }
+}
+
+void gl_state_bind_array_buffer(GLuint buf) {
+  if (changed(state.array_buf != buf)) {
+    state.array_buf = buf;
+    GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, buf));
+  }
+}
+
+void gl_state_vertex_attrib(GLuint index, GLint size, GLenum type,
+                            GLsizei stride, GLuint offset) {
+  if (index < max_attribs) {
+    auto &a = state.attribs[index];
+    if (!changed(!a.valid || !a.enabled || a.size != size ||
+                     a.type != type || a.stride != stride ||
+                     a.offset != offset || a.buf != state.array_buf,
+                 2))
+      return;
+    a = {true, true, size, type, stride, offset, state.array_buf};
+  } else {
+    state.stats.issued += 2;
+  }
+  GL_CHECK(glEnableVertexAttribArray(index));
+  GL_CHECK(glVertexAttribPointer(index, size, type, GL_FALSE, stride,
+                                 (const void *)(uintptr_t)offset));
+}
+
+void gl_state_disable_vertex_attrib(GLuint index) {
+  if (index < max_attribs) {
+    auto &a = state.attribs[index];
+    if (!changed(!a.valid || a.enabled))
+      return;
+    a.valid = true;
+    a.enabled = false;
+  } else {
+    state.stats.issued++;
+  }
+  GL_CHECK(glDisableVertexAttribArray(index));
+}
+
+void gl_state_bind_fullscreen_quad() {
+  static std::mutex mutex;
+  static GLuint quad_buf = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (quad_buf == 0) {
+      static const float quad[] = {-1, -1, 1, -1, -1, 1,
+                                   -1, 1,  1, -1, 1,  1};
+      GL_CHECK(glGenBuffers(1, &quad_buf));
+      gl_state_bind_array_buffer(quad_buf);
+      GL_CHECK(
+          glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW));
+    }
+  }
+  gl_state_bind_array_buffer(quad_buf);
+  gl_state_vertex_attrib(ATTRIB_POS, 2, GL_FLOAT, 0, 0);
+}
+
+gl_state_stats get_gl_state_stats() { return state.stats; }
+
+void print_gl_state_stats() {
+  uint64_t total = state.stats.issued + state.stats.elided;
+  printf("GL state: %llu calls issued, %llu elided (%.1f%%)\n",
+         (unsigned long long)state.stats.issued,
+         (unsigned long long)state.stats.elided,
+         total ? 100.0 * state.stats.elided / total : 0.0);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "glad/gles2.h"
+#include <stdint.h>
+
+/*
+ * Shadow copy of the GL state the render path changes, calls that would
+ * not change anything are dropped. The cache is per thread, like the
+ * current context. Code that changes this state behind its back (setup
+ * code, other libraries) has to call gl_state_invalidate() afterwards.
+ */
+struct gl_state_stats {
+  uint64_t issued = 0;
+  uint64_t elided = 0;
+};
+
+void gl_state_invalidate();
+
+void gl_state_use_program(GLuint prog);
+void gl_state_bind_framebuffer(GLuint fb);
+// also selects `unit` as the active texture unit when it binds
+void gl_state_bind_texture(int unit, GLenum target, GLuint tex);
+// min and mag filter of `tex`, bound to `unit` first
+void gl_state_texture_filter(int unit, GLenum target, GLuint tex,
+                             GLenum filter);
+void gl_state_viewport(int x, int y, int w, int h);
+// enables GL_SCISSOR_TEST with this box, glClear honors it too
+void gl_state_scissor(int x, int y, int w, int h);
+void gl_state_disable_scissor();
+void gl_state_clear_color(float r, float g, float b, float a);
+void gl_state_bind_array_buffer(GLuint buf);
+// enables `index` and points it at `offset` in the bound array buffer
+void gl_state_vertex_attrib(GLuint index, GLint size, GLenum type,
+                            GLsizei stride, GLuint offset);
+void gl_state_disable_vertex_attrib(GLuint index);
+/*
+ * Points ATTRIB_POS at the fullscreen quad every pass draws with, the
+ * buffer is created on first use and shared by the contexts of a share
+ * group. Vertex attributes are per context, every render thread calls
+ * this once and again after drawing from another buffer.
+ */
+void gl_state_bind_fullscreen_quad();
+
+gl_state_stats get_gl_state_stats();
+void print_gl_state_stats();
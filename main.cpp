@@ -14,21 +14,25 @@
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "common.h"
+#include "crop_atlas.hpp"
+#include "downscale.hpp"
+#include "egl_context.hpp"
+#include "fp16_output.hpp"
+#include "gl_debug.hpp"
+#include "gl_state.hpp"
+#include "mosaic.hpp"
+#include "output_spec.hpp"
+#include "render_queue.hpp"
+#include "render_worker.hpp"
+#include "shader.hpp"
+#include "tiles.hpp"
 #include "stb_image.h"
 #include "stbi_image_write.h"
+#include <atomic>
 #include <chrono>
 #include <fstream>
 #include <streambuf>
-
-static const EGLint configAttribs[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
-                                       EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
-                                       EGL_NONE};
-std::string read_file(const char *path) {
-  std::ifstream t(path);
-  std::string str((std::istreambuf_iterator<char>(t)),
-                  std::istreambuf_iterator<char>());
-  return str;
-}
+#include <thread>
 
 std::string egl_error_string(EGLint error) {
   switch (error) {
@@ -94,11 +98,6 @@ struct Img {
   GLuint tex;
 };
 
-static const int pbufferWidth = 640;
-static const int pbufferHeight = 640;
-static const EGLint pbufferAttribs[] = {
-    EGL_WIDTH, pbufferWidth, EGL_HEIGHT, pbufferHeight, EGL_NONE,
-};
 Img load_img(const char *path) {
   Img img;
   int c;
@@ -115,79 +114,6 @@ Img load_img(const char *path) {
   return img;
 }
 
-GLuint create_prog(const char *vert, const char *frag) {
-  auto vert_src = read_file(vert);
-  auto frag_src = read_file(frag);
-  unsigned int vertexShader = glCreateShader(GL_VERTEX_SHADER);
-
-  GL_CHECK(int vertexShader = 0;);
-  const char *ptr = vert_src.data();
-  std::cout << "Compiling " << ptr << "\n";
-  GL_CHECK(glShaderSource(vertexShader, 1, &ptr, NULL));
-  GL_CHECK(glCompileShader(vertexShader));
-  // check for shader compile errors
-  int success;
-  char infoLog[512];
-  GL_CHECK(glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success));
-  if (!success) {
-    GLint logLength;
-    glGetShaderiv(vertexShader, GL_INFO_LOG_LENGTH, &logLength);
-    glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
-    std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n"
-              << logLength << "\n"
-              << infoLog << std::endl;
-
-    exit(1);
-  }
-  // fragment shader
-  unsigned int fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-  ptr = frag_src.data();
-  glShaderSource(fragmentShader, 1, &ptr, NULL);
-  glCompileShader(fragmentShader);
-  // check for shader compile errors
-  glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
-  if (!success) {
-    glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
-    std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n"
-              << infoLog << std::endl;
-
-    exit(1);
-  }
-  std::cout << "Compiling " << ptr << "\n";
-  glShaderSource(vertexShader, 1, &ptr, NULL);
-  // link shaders
-  unsigned int shaderProgram = glCreateProgram();
-  glAttachShader(shaderProgram, vertexShader);
-  glAttachShader(shaderProgram, fragmentShader);
-  glLinkProgram(shaderProgram);
-  // check for linking errors
-  glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
-  if (!success) {
-    glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
-    std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n"
-              << infoLog << std::endl;
-    exit(1);
-  }
-
-  std::cout << "Compiling Success \n";
-  glDeleteShader(vertexShader);
-  glDeleteShader(fragmentShader);
-  return shaderProgram;
-}
-static void EGLAPIENTRY LogEGLDebugMessage(EGLenum error, const char *command,
-                                           EGLint message_type,
-                                           EGLLabelKHR thread_label,
-                                           EGLLabelKHR object_label,
-                                           const char *message) {
-  std::cout << "EGL Error:" << command << "=> " << message;
-}
-static void on_gl_error(GLenum source, GLenum type, GLuint id, GLenum severity,
-                        GLsizei length, const GLchar *message,
-                        const void *userParam) {
-
-  printf("%s\n", message);
-}
-
 static int dmabuf_sync(int buf_fd, bool start) {
   struct dma_buf_sync sync = {0};
 
@@ -201,9 +127,51 @@ static int dmabuf_sync(int buf_fd, bool start) {
 
   return -1;
 }
+static void dump_frame(const egl_dma_frame &frame, const std::string &path) {
+  wait_fence_fd(frame.fence.fd);
+  void *map = mmap(0, frame.size_bytes, PROT_READ, MAP_SHARED, frame.fd, 0);
+  if (map == MAP_FAILED) {
+    printf("Failed to map frame: %s\n", strerror(errno));
+    return;
+  }
+
+  dmabuf_sync(frame.fd, true);
+  if (frame.drm_format == DRM_FORMAT_NV12) {
+    stbi_write_png(path.c_str(), frame.w, frame.h, 1, map, frame.w * 1);
+  }
+  if (frame.drm_format == DRM_FORMAT_RGBA8888) {
+    stbi_write_png(path.c_str(), frame.w, frame.h, 4, map, frame.w * 4);
+  }
+  if (frame.drm_format == DRM_FORMAT_RG88) {
+    stbi_write_png(path.c_str(), frame.w, frame.h, 2, map, frame.w * 2);
+  }
+  if (frame.drm_format == DRM_FORMAT_RGB888) {
+    stbi_write_png(path.c_str(), frame.w, frame.h, 3, map, frame.w * 3);
+  }
+  if (frame.drm_format == DRM_FORMAT_R8) {
+    stbi_write_png(path.c_str(), frame.w, frame.h, 1, map, frame.w * 1);
+  }
+  if (frame.drm_format == DRM_FORMAT_ABGR16161616F) {
+    // [0, 1] mapped to 8 bit, normalized tensors come out clipped
+    std::vector<uint8_t> rgba(frame.w * frame.h * 4);
+    auto *half = (const uint16_t *)map;
+    for (size_t i = 0; i < rgba.size(); i++) {
+      float v = half_to_float(half[i]);
+      rgba[i] = std::min(std::max(v, 0.0f), 1.0f) * 255.0f;
+    }
+    stbi_write_png(path.c_str(), frame.w, frame.h, 4, rgba.data(), frame.w * 4);
+  }
+  if (frame.drm_format == FORMAT_RGB_CHW) {
+    // the three planes stacked vertically
+    stbi_write_png(path.c_str(), frame.w, frame.h * 3, 1, map, frame.w * 1);
+  }
+  dmabuf_sync(frame.fd, false);
+  munmap(map, frame.size_bytes);
+}
+
 int main(int argc, const char **argv) {
   gladLoaderLoadEGL(EGL_NO_DISPLAY);
-  EGLDisplay eglDpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  EGLDisplay eglDpy = get_egl_display();
 
   EGLint major, minor;
   if (!eglInitialize(eglDpy, &major, &minor)) {
@@ -212,176 +180,408 @@ int main(int argc, const char **argv) {
   }
 
   gladLoaderLoadEGL(eglDpy);
+  gl_debug_init_egl();
 
   std::cout << "EGL extensions: " << eglQueryString(eglDpy, EGL_EXTENSIONS)
             << "\n";
 
-  // 2. Select an appropriate configuration
-  EGLint numConfigs;
-  EGLConfig eglCfg;
-  if (!eglChooseConfig(eglDpy, configAttribs, &eglCfg, 1, &numConfigs)) {
-    print_gl_error("eglChooseConfig");
-    return 1;
-  }
-
-  // 3. Create a surface
-  EGLSurface eglSurf = eglCreatePbufferSurface(eglDpy, eglCfg, pbufferAttribs);
-  assert(eglSurf != EGL_NO_SURFACE);
-  print_gl_error("eglCreatePbufferSurface");
-
-  // 5. Create a context and make it current
-  //
-  EGLint ctx_attribs[] = {EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE};
-  EGLContext eglCtx =
-      eglCreateContext(eglDpy, eglCfg, EGL_NO_CONTEXT, ctx_attribs);
-
-  if (!eglBindAPI(EGL_OPENGL_ES_API)) {
-    print_gl_error("eglBindAPI");
+  egl_context ctx = create_egl_context(eglDpy);
+  if (ctx.ctx == EGL_NO_CONTEXT) {
     return 1;
   }
-  if (!eglMakeCurrent(eglDpy, eglSurf, eglSurf, eglCtx)) {
-    print_gl_error("eglMakeCurrent");
+  std::cout << "Surfaceless: " << (ctx.surf == EGL_NO_SURFACE ? "yes" : "no")
+            << "\n";
+  if (!make_current(ctx)) {
     return 1;
   }
+  EGLContext eglCtx = ctx.ctx;
 
-  // EGLAttrib controls[] = {
-  //     EGL_DEBUG_MSG_CRITICAL_KHR,
-  //     EGL_TRUE,
-  //     EGL_DEBUG_MSG_ERROR_KHR,
-  //     EGL_TRUE,
-  //     EGL_DEBUG_MSG_WARN_KHR,
-  //     EGL_TRUE,
-  //     EGL_DEBUG_MSG_INFO_KHR,
-  //     EGL_TRUE,
-  //     EGL_NONE,
-  // };
-  // eglDebugMessageControlKHR(&LogEGLDebugMessage, controls);
   int val;
   eglQueryContext(eglDpy, eglCtx, EGL_CONTEXT_CLIENT_VERSION, &val);
   assert(val == 2);
 
   std::cout << "API version: " << gladLoaderLoadGLES2() << "\n";
   std::cout << "GLES extensions: " << glGetString(GL_EXTENSIONS) << "\n";
-  // During init, enable debug output
-  GLuint simple_shdr =
-      create_prog("shaders/simple.vert", "shaders/simple.frag");
-  std::vector<float> fullscreen_quad = {-1, -1, 1, -1, -1, 1,
-                                        -1, 1,  1, -1, 1,  1};
-  GLuint fullscreen_quad_buf;
-  GL_CHECK(glGenBuffers(1, &fullscreen_quad_buf));
-  GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, fullscreen_quad_buf));
-  glBufferData(GL_ARRAY_BUFFER, fullscreen_quad.size() * 4,
-               fullscreen_quad.data(), GL_STATIC_DRAW);
-  glUseProgram(simple_shdr);
-  int loc = glGetAttribLocation(simple_shdr, "pos");
-  glEnableVertexAttribArray(loc);
-  GL_CHECK(glVertexAttribPointer(loc, 2, GL_FLOAT, GL_FALSE, 0, 0));
-
-  std::vector<char> buffer(pbufferHeight * pbufferWidth * 4);
-  EGLint fence_attrib[] = {EGL_NONE};
+  gl_debug_init_gl();
+  if (const char *interval = getenv("EGL_MALI_GL_CHECK_INTERVAL"))
+    set_gl_check_interval(atoi(interval));
+  if (!egl_sync_init(eglDpy)) {
+    return 1;
+  }
+  gl_state_bind_fullscreen_quad();
 
-  GL_CHECK(glViewport(0, 0, pbufferWidth, pbufferHeight));
+  EGLint fence_attrib[] = {EGL_NONE};
 
-  GL_CHECK(glActiveTexture(GL_TEXTURE0));
+  if (argc > 1 && strcmp(argv[1], "--bench-downscale") == 0) {
+    bool ok = benchmark_downscale(1920, 1536, 640, 512, 100);
+    flush_gl_debug_log();
+    destroy_egl_context(ctx);
+    eglTerminate(eglDpy);
+    return ok ? 0 : 1;
+  }
 
   auto img = load_img("test.jpg");
 
   v4l2_device_info v4l2_dev =
       open_video_device(argv[1], 1920, 1536, V4L2_PIX_FMT_NV12);
-  v4l2_dma_device_info v4l2_dma_dev = init_dma(v4l2_dev, 3, eglDpy, eglCtx);
-  auto out_frames =
-      create_egl_frame(v4l2_dev, v4l2_dma_dev, eglDpy, 30, pbufferWidth,
-                       pbufferHeight, DRM_FORMAT_RG88);
+  /*
+   * EGL_MALI_RENDER_AHEAD=N frames may be in flight, 1 (the default) is the
+   * latency mode. Every frame in flight holds a capture buffer. The loop
+   * reserves a queue slot before it dequeues, so N buffers are out at a
+   * time and two more stay queued for the driver to capture into.
+   */
+  int depth = 1;
+  if (const char *ahead = getenv("EGL_MALI_RENDER_AHEAD"))
+    depth = std::max(atoi(ahead), 1);
+  v4l2_dma_device_info v4l2_dma_dev =
+      init_dma(v4l2_dev, depth + 2, eglDpy, eglCtx);
+  detect_fp16_caps(eglDpy, v4l2_dma_dev.dma_heap_fd);
+  // detector input, classifier input and preview from the same capture
+  std::vector<output_spec> specs = {
+      {640, 640, DRM_FORMAT_NV12},
+      {224, 224, DRM_FORMAT_RGBA8888},
+      {320, 240, DRM_FORMAT_RGBA8888},
+  };
+  specs[0].fit = output_fit::letterbox;
+  specs[0].pad_color[0] = specs[0].pad_color[1] = specs[0].pad_color[2] =
+      114 / 255.0f;
+  // 3x reduction, the plain filter aliases on fine detail
+  specs[0].downscale = output_downscale::area;
+  specs[1].fit = output_fit::center_crop;
+  /*
+   * EGL_MALI_OVERLAY=1 burns boxes and a timestamp into the preview,
+   * submitted from a thread of their own like detections would be.
+   */
+  overlay_queue overlay;
+  specs[2].overlay = getenv("EGL_MALI_OVERLAY") != nullptr;
+  /*
+   * EGL_MALI_PRIVACY=1 pixelates a fixed zone and a moving rectangle, a
+   * stand-in for a detected face, in the preview only.
+   */
+  privacy_masks masks;
+  specs[2].mask.enabled = getenv("EGL_MALI_PRIVACY") != nullptr;
+  masks.zones.push_back({0, 0, 640, 0, 640, 200, 320, 400, 0, 400});
+  if (argc > 2) {
+    // model input tensor, quantized on the GPU
+    output_spec tensor = {640, 640, FORMAT_RGB_CHW};
+    if (!load_model_descriptor(argv[2], tensor)) {
+      return 1;
+    }
+    specs.push_back(tensor);
+  }
 
-  for (int i = 0; i < out_frames.size(); i++) {
-    // GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+  /*
+   * EGL_MALI_RENDER_WORKERS=N spreads the specs over N render threads, one
+   * stream each, so their submission runs on separate cores. Without it
+   * everything renders on this thread.
+   */
+  int num_workers = 0;
+  if (const char *workers = getenv("EGL_MALI_RENDER_WORKERS"))
+    num_workers = std::min(atoi(workers), (int)specs.size());
+  render_worker_pool pool;
+  if (num_workers > 0) {
+    pool = create_render_workers(eglDpy, eglCtx, num_workers, [] {
+      gl_debug_init_gl();
+      gl_state_bind_fullscreen_quad();
+    });
+    if (pool.workers.empty()) {
+      return 1;
+    }
+  }
+  int num_streams = std::max(num_workers, 1);
+  std::vector<output_stream> streams(num_streams);
+  // global spec index of every spec of a stream
+  std::vector<std::vector<int>> stream_specs(num_streams);
+  // capture textures of the context a stream renders on
+  std::vector<std::vector<GLuint>> capture_tex(num_streams);
+  std::vector<render_worker *> stream_workers(num_streams, nullptr);
+  for (size_t j = 0; j < specs.size(); j++)
+    stream_specs[j % num_streams].push_back(j);
+  std::vector<std::future<void>> jobs;
+  for (int k = 0; k < num_streams; k++) {
+    auto create = [&, k] {
+      std::vector<output_spec> subset;
+      bool overlaid = false, masked = false;
+      for (int j : stream_specs[k]) {
+        subset.push_back(specs[j]);
+        overlaid = overlaid || specs[j].overlay;
+        masked = masked || specs[j].mask.enabled;
+      }
+      streams[k] = create_output_stream(
+          v4l2_dev, v4l2_dma_dev, eglDpy, subset, 30,
+          overlaid ? &overlay : nullptr, masked ? &masks : nullptr);
+      if (stream_workers[k]) {
+        capture_tex[k] = import_capture_textures(v4l2_dma_dev);
+      } else {
+        for (auto &img : v4l2_dma_dev.egl_imgs)
+          capture_tex[k].push_back(img.tex);
+      }
+    };
+    if (num_workers > 0) {
+      stream_workers[k] = &assign_render_worker(pool, k);
+      jobs.push_back(submit_render_job(*stream_workers[k], create));
+    } else {
+      create();
+    }
+  }
+  for (auto &job : jobs)
+    job.get();
+  for (auto &stream : streams) {
+    if (stream.frames.empty()) {
+      return 1;
+    }
+    // per pass GPU times, serializes the passes
+    stream.graph.profile = getenv("EGL_MALI_PROFILE") != nullptr;
+  }
+  /*
+   * EGL_MALI_MOSAIC=1 adds a 2x2 mosaic of 640x640 cells. There is only
+   * one camera here, it fills every cell.
+   */
+  mosaic_stream mosaic;
+  if (getenv("EGL_MALI_MOSAIC")) {
+    mosaic_spec ms;
+    ms.cell = {640, 640, DRM_FORMAT_RGBA8888};
+    ms.cell.fit = output_fit::letterbox;
+    std::vector<int> cam_w(ms.cameras, v4l2_dev.fmt.fmt.pix_mp.width);
+    std::vector<int> cam_h(ms.cameras, v4l2_dev.fmt.fmt.pix_mp.height);
+    mosaic = create_mosaic_stream(v4l2_dev, v4l2_dma_dev, eglDpy, ms, cam_w,
+                                  cam_h, streams[0].num_slots);
+    if (mosaic.frames.empty()) {
+      return 1;
+    }
+  }
+  /*
+   * EGL_MALI_TILES=1 adds 640x640 detector tiles of the native capture and
+   * a global view, a stream of their own so they share one batch. A full
+   * resolution tile set is big, it cycles through a few slots.
+   */
+  output_stream tiles;
+  int last_tile_slot = -1;
+  if (getenv("EGL_MALI_TILES")) {
+    tile_spec ts;
+    ts.tile = {640, 640, DRM_FORMAT_RGBA8888};
+    auto plan = plan_tiles(ts, v4l2_dev.fmt.fmt.pix_mp.width,
+                           v4l2_dev.fmt.fmt.pix_mp.height);
+    tiles = create_output_stream(v4l2_dev, v4l2_dma_dev, eglDpy, plan.specs,
+                                 3);
+    if (tiles.frames.empty()) {
+      return 1;
+    }
+  }
+  /*
+   * EGL_MALI_CROP_ATLAS=1 crops fixed boxes, standing in for detections,
+   * into 128x256 re-ID inputs once the frame is submitted.
+   */
+  crop_atlas atlas;
+  std::vector<crop_roi> demo_rois = {
+      {100, 200, 180, 420}, {900, 600, 90, 200}, {1700, 1200, 300, 500}};
+  std::vector<crop_atlas_tile> atlas_tiles;
+  if (getenv("EGL_MALI_CROP_ATLAS")) {
+    crop_atlas_spec cs;
+    cs.crop = {128, 256, DRM_FORMAT_RGBA8888};
+    cs.crop.fit = output_fit::letterbox;
+    cs.max_crops = 16;
+    atlas = create_crop_atlas(v4l2_dev, v4l2_dma_dev, eglDpy, cs,
+                              v4l2_dev.fmt.fmt.pix_mp.width,
+                              v4l2_dev.fmt.fmt.pix_mp.height,
+                              streams[0].num_slots);
+    if (atlas.frames.empty()) {
+      return 1;
+    }
+  }
+  flush_gl_debug_log();
+
+  // a tile slot is rendered again tiles.num_slots frames later
+  if (!tiles.frames.empty())
+    depth = std::min(depth, tiles.num_slots);
+  render_queue queue = create_render_queue(depth);
+  // the capture buffer may only be requeued once the GPU stopped reading it
+  auto requeue_capture = [&](const render_queue_frame &frame) {
     v4l2_buffer buf;
     v4l2_plane planes[VIDEO_MAX_PLANES];
-    int buf_index;
-
-    auto t0 = std::chrono::high_resolution_clock::now();
-    /* dequeue a buffer */
     memset(&buf, 0, sizeof(buf));
+    buf.index = frame.capture_index;
     buf.memory = V4L2_MEMORY_DMABUF;
     if (v4l2_dev.mplane_api) {
       buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
       memset(&planes, 0, sizeof(planes));
       buf.m.planes = planes;
       buf.length = 1;
+
+      buf.m.planes[0].m.fd = v4l2_dma_dev.dma_bufs[frame.capture_index];
+
     } else {
       buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+      buf.m.fd = v4l2_dma_dev.dma_bufs[frame.capture_index];
     }
-    if (ioctl(v4l2_dev.fd, VIDIOC_DQBUF, &buf)) {
-      printf("VIDIOC_DQBUF: %s\n", strerror(errno));
-      continue;
-    }
-    buf_index = buf.index;
-    GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, out_frames[i].fb));
 
-    GL_CHECK(glBindTexture(GL_TEXTURE_EXTERNAL_OES,
-                           v4l2_dma_dev.egl_imgs[buf_index].tex));
+    if (ioctl(v4l2_dev.fd, VIDIOC_QBUF, &buf)) {
+      printf("VIDIOC_QBUF: %s\n", strerror(errno));
+    }
+  };
+
+  std::atomic<bool> overlay_stop(false);
+  std::thread overlay_producer;
+  if (specs[2].overlay) {
+    overlay_producer = std::thread([&] {
+      overlay_list list;
+      for (int n = 0; !overlay_stop; n++) {
+        list.boxes.resize(2);
+        list.boxes[0] = {400.0f + 10 * (n % 50), 300, 400, 800};
+        list.boxes[0].label = "person 0.91";
+        list.boxes[1] = {1200, 900, 500, 300};
+        list.boxes[1].color[0] = 1;
+        list.boxes[1].label = "car 0.78";
+        auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch());
+        char stamp[32];
+        snprintf(stamp, sizeof(stamp), "%lld.%03lld",
+                 (long long)now.count() / 1000,
+                 (long long)now.count() % 1000);
+        list.texts.resize(1);
+        list.texts[0] = {4, 4};
+        list.texts[0].text = stamp;
+        list.text_scale = 0.5f;
+        submit_overlay(overlay, list);
+        std::this_thread::sleep_for(std::chrono::milliseconds(33));
+      }
+    });
+  }
 
-    GL_CHECK(glDrawArrays(GL_TRIANGLES, 0, 6));
+  // no console output in the loop, the frame times are summarized after it
+  double total_ms = 0, max_ms = 0;
+  int timed_frames = 0;
 
-    // GL_CHECK(glReadPixels(0, 0, pbufferWidth, pbufferHeight, GL_RGBA,
-    //                       GL_UNSIGNED_BYTE, buffer.data()));
-    GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, 0));
-    eglWaitGL();
-    std::cout << "eglSwapBuffers\n";
-    eglSwapBuffers(eglDpy, eglSurf);
+  for (int i = 0; i < streams[0].num_slots; i++) {
+    // GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+    v4l2_buffer buf;
+    v4l2_plane planes[VIDEO_MAX_PLANES];
+    int buf_index;
 
-    /* enqueue a buffer */
+    auto t0 = std::chrono::high_resolution_clock::now();
+    // retires the oldest frame first when the queue is full, so its capture
+    // buffer is back with the driver before this one is taken
+    reserve_render_frame(eglDpy, queue, requeue_capture);
+    /* dequeue a buffer */
     memset(&buf, 0, sizeof(buf));
-    buf.index = buf_index;
     buf.memory = V4L2_MEMORY_DMABUF;
     if (v4l2_dev.mplane_api) {
       buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
       memset(&planes, 0, sizeof(planes));
       buf.m.planes = planes;
       buf.length = 1;
-
-      buf.m.planes[0].m.fd = v4l2_dma_dev.dma_bufs[buf_index];
-
     } else {
       buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-      buf.m.fd = v4l2_dma_dev.dma_bufs[buf_index];
     }
-
-    std::cout << "VIDIOC_QBUF\n";
-    if (ioctl(v4l2_dev.fd, VIDIOC_QBUF, &buf)) {
-      printf("VIDIOC_QBUF: %s\n", strerror(errno));
+    if (ioctl(v4l2_dev.fd, VIDIOC_DQBUF, &buf)) {
+      printf("VIDIOC_DQBUF: %s\n", strerror(errno));
+      continue;
+    }
+    buf_index = buf.index;
+    if (specs[2].mask.enabled) {
+      std::vector<mask_rect> faces = {{800.0f + 20 * i, 500, 160, 200}};
+      submit_mask_rects(masks, faces);
+    }
+    std::vector<egl_frame_fence> batch_fences(num_streams);
+    jobs.clear();
+    for (int k = 0; k < num_streams; k++) {
+      auto render = [&, k] {
+        batch_fences[k] = render_output_batch(eglDpy, streams[k],
+                                              capture_tex[k][buf_index], i);
+      };
+      if (stream_workers[k])
+        jobs.push_back(submit_render_job(*stream_workers[k], render));
+      else
+        render();
+    }
+    if (!mosaic.frames.empty()) {
+      std::vector<GLuint> cameras(mosaic.cells.size(),
+                                  v4l2_dma_dev.egl_imgs[buf_index].tex);
+      batch_fences.push_back(render_mosaic(eglDpy, mosaic, cameras, i));
+    }
+    if (!tiles.frames.empty()) {
+      last_tile_slot = i % tiles.num_slots;
+      batch_fences.push_back(render_output_batch(
+          eglDpy, tiles, v4l2_dma_dev.egl_imgs[buf_index].tex,
+          last_tile_slot));
+    }
+    for (auto &job : jobs)
+      job.get();
+    push_render_frame(queue, {i, buf_index, batch_fences, buf.sequence});
+    // the capture stays queued until the crops are rendered from it
+    auto *queued = find_render_frame(queue, buf.sequence);
+    if (!atlas.frames.empty() && queued) {
+      auto crops = render_crop_atlas(
+          eglDpy, atlas, v4l2_dma_dev.egl_imgs[queued->capture_index].tex,
+          demo_rois, i);
+      queued->fences.push_back(crops.fence);
+      atlas_tiles = crops.tiles;
     }
 
     auto t1 = std::chrono::high_resolution_clock::now();
-    std::cout << "Took: "
-              << std::chrono::duration<double>(t1 - t0).count() * 1000
-              << "ms\n";
+    double ms = std::chrono::duration<double>(t1 - t0).count() * 1000;
+    total_ms += ms;
+    max_ms = std::max(max_ms, ms);
+    timed_frames++;
+  }
+  drain_render_queue(eglDpy, queue, requeue_capture);
+  overlay_stop = true;
+  if (overlay_producer.joinable())
+    overlay_producer.join();
+  if (timed_frames > 0) {
+    printf("Frames: %i, avg %.2fms, max %.2fms\n", timed_frames,
+           total_ms / timed_frames, max_ms);
   }
 
-  for (int i = 0; i < out_frames.size(); i++) {
-    void *map = mmap(0, out_frames[i].size_bytes, PROT_READ, MAP_SHARED,
-                     out_frames[i].fd, 0);
-
-    dmabuf_sync(out_frames[i].fd, true);
-    if (out_frames[i].drm_format == DRM_FORMAT_NV12) {
-
-      stbi_write_png(("out" + std::to_string(i) + ".png").c_str(),
-                     out_frames[i].w, out_frames[i].h, 1, map,
-                     pbufferWidth * 1);
-    }
-    if (out_frames[i].drm_format == DRM_FORMAT_RGBA8888) {
-      stbi_write_png(("out" + std::to_string(i) + ".png").c_str(),
-                     out_frames[i].w, out_frames[i].h, 4, map,
-                     pbufferWidth * 4);
-    }
-    if (out_frames[i].drm_format == DRM_FORMAT_RG88) {
-      stbi_write_png(("out" + std::to_string(i) + ".png").c_str(),
-                     out_frames[i].w, out_frames[i].h, 2, map,
-                     pbufferWidth * 2);
+  for (auto &stream : streams)
+    print_render_graph_stats(stream.graph);
+  if (!mosaic.frames.empty())
+    print_render_graph_stats(mosaic.graph);
+  if (!tiles.frames.empty())
+    print_render_graph_stats(tiles.graph);
+  if (!atlas.frames.empty())
+    print_render_graph_stats(atlas.graph);
+  // the state caches are per thread
+  for (auto &worker : pool.workers)
+    submit_render_job(*worker, print_gl_state_stats).get();
+  print_gl_state_stats();
+  print_render_worker_stats(pool);
+  print_render_queue_stats(queue);
+  flush_gl_debug_log();
+
+  for (int k = 0; k < num_streams; k++) {
+    auto &stream = streams[k];
+    for (size_t s = 0; s < stream.frames.size(); s++) {
+      for (int i = 0; i < stream.num_slots; i++) {
+        dump_frame(stream.frames[s][i],
+                   "out" + std::to_string(stream_specs[k][s]) + "_" +
+                       std::to_string(i) + ".png");
+      }
     }
   }
+  for (size_t i = 0; i < mosaic.frames.size(); i++)
+    dump_frame(mosaic.frames[i], "mosaic_" + std::to_string(i) + ".png");
+  for (size_t i = 0; i < atlas.frames.size(); i++)
+    dump_frame(atlas.frames[i], "crops_" + std::to_string(i) + ".png");
+  for (size_t t = 0; t < atlas_tiles.size(); t++) {
+    auto &tile = atlas_tiles[t];
+    printf("crop_%zu: %d,%d %dx%d, offset %.1f,%.1f scale %.3f,%.3f\n", t,
+           tile.x, tile.y, tile.w, tile.h, tile.transform.offset_x,
+           tile.transform.offset_y, tile.transform.scale_x,
+           tile.transform.scale_y);
+  }
+  // the last rendered slot, the transform maps detections back to the frame
+  for (size_t t = 0; last_tile_slot >= 0 && t < tiles.frames.size(); t++) {
+    auto &frame = tiles.frames[t][last_tile_slot];
+    auto &tf = frame.transform;
+    printf("tile_%zu: offset %.1f,%.1f scale %.3f,%.3f\n", t, tf.offset_x,
+           tf.offset_y, tf.scale_x, tf.scale_y);
+    dump_frame(frame, "tile_" + std::to_string(t) + ".png");
+  }
+  destroy_render_workers(pool);
 
   // 6. Terminate EGL when finished
+  destroy_egl_context(ctx);
   eglTerminate(eglDpy);
   return 0;
 }
@@ -0,0 +1,133 @@
+#include "mask.hpp"
+#include "common.h"
+#include "gl_state.hpp"
+#include "shader.hpp"
+#include <algorithm>
+#include <stdio.h>
+#include <utility>
+
+void submit_mask_rects(privacy_masks &masks, std::vector<mask_rect> &rects) {
+  std::lock_guard<std::mutex> lock(masks.mutex);
+  std::swap(masks.rects, rects);
+  masks.version++;
+}
+
+static float cross(const float *a, const float *b, const float *c) {
+  return (b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]);
+}
+
+// ear clipping, zones are a handful of points so O(n^3) is fine
+static bool triangulate(const std::vector<float> &points,
+                        std::vector<float> &tris) {
+  int n = points.size() / 2;
+  if (n < 3)
+    return false;
+  std::vector<const float *> poly;
+  float area = 0;
+  for (int i = 0; i < n; i++) {
+    poly.push_back(&points[2 * i]);
+    const float *a = &points[2 * i], *b = &points[2 * ((i + 1) % n)];
+    area += a[0] * b[1] - b[0] * a[1];
+  }
+  // counter-clockwise, ears then have a positive cross product
+  if (area < 0)
+    std::reverse(poly.begin(), poly.end());
+  auto emit = [&](const float *a, const float *b, const float *c) {
+    tris.insert(tris.end(), {a[0], a[1], b[0], b[1], c[0], c[1]});
+  };
+  while (poly.size() > 3) {
+    int m = poly.size();
+    bool clipped = false;
+    for (int i = 0; i < m && !clipped; i++) {
+      const float *a = poly[(i + m - 1) % m], *b = poly[i];
+      const float *c = poly[(i + 1) % m];
+      if (cross(a, b, c) <= 0)
+        continue;
+      bool contains = false;
+      for (int j = 0; j < m && !contains; j++) {
+        const float *p = poly[j];
+        if (p == a || p == b || p == c)
+          continue;
+        contains = cross(a, b, p) >= 0 && cross(b, c, p) >= 0 &&
+                   cross(c, a, p) >= 0;
+      }
+      if (contains)
+        continue;
+      emit(a, b, c);
+      poly.erase(poly.begin() + i);
+      clipped = true;
+    }
+    // self intersecting or degenerate
+    if (!clipped)
+      return false;
+  }
+  emit(poly[0], poly[1], poly[2]);
+  return true;
+}
+
+bool create_mask_renderer(mask_renderer &r, const privacy_masks &masks) {
+  for (size_t z = 0; z < masks.zones.size(); z++) {
+    if (!triangulate(masks.zones[z], r.zone_tris)) {
+      printf("Mask zone %zu is not a simple polygon\n", z);
+      return false;
+    }
+  }
+  GL_CHECK(glGenBuffers(1, &r.vbo));
+  return true;
+}
+
+bool update_masks(mask_renderer &r, privacy_masks &masks) {
+  {
+    std::lock_guard<std::mutex> lock(masks.mutex);
+    if (masks.version == r.version)
+      return false;
+    r.rects = masks.rects;
+    r.version = masks.version;
+  }
+  r.vertices.clear();
+  r.first.clear();
+  r.count.clear();
+  return true;
+}
+
+int add_mask_target(mask_renderer &r, const frame_transform &transform, int w,
+                    int h) {
+  int first = r.vertices.size() / 2;
+  // sensor = output * scale + offset, then output pixels to clip space
+  auto add = [&](float x, float y) {
+    r.vertices.push_back((x - transform.offset_x) / transform.scale_x / w * 2 -
+                         1);
+    r.vertices.push_back((y - transform.offset_y) / transform.scale_y / h * 2 -
+                         1);
+  };
+  for (size_t i = 0; i < r.zone_tris.size(); i += 2)
+    add(r.zone_tris[i], r.zone_tris[i + 1]);
+  for (const auto &rect : r.rects) {
+    float x1 = rect.x + rect.w, y1 = rect.y + rect.h;
+    add(rect.x, rect.y);
+    add(x1, rect.y);
+    add(rect.x, y1);
+    add(rect.x, y1);
+    add(x1, rect.y);
+    add(x1, y1);
+  }
+  r.first.push_back(first);
+  r.count.push_back(r.vertices.size() / 2 - first);
+  return r.first.size() - 1;
+}
+
+void upload_masks(mask_renderer &r) {
+  if (r.vertices.empty())
+    return;
+  // orphans the previous contents, the GPU may still read them
+  gl_state_bind_array_buffer(r.vbo);
+  GL_CHECK(glBufferData(GL_ARRAY_BUFFER, r.vertices.size() * sizeof(float),
+                        r.vertices.data(), GL_STREAM_DRAW));
+}
+
+void draw_mask_geometry(mask_renderer &r, int target) {
+  gl_state_bind_array_buffer(r.vbo);
+  gl_state_vertex_attrib(ATTRIB_POS, 2, GL_FLOAT, 0, 0);
+  GL_CHECK(glDrawArrays(GL_TRIANGLES, r.first[target], r.count[target]));
+  gl_state_bind_fullscreen_quad();
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "glad/gles2.h"
+#include "v4l2_device.hpp"
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+/*
+ * Privacy masking of exported outputs (previews, recordings): masked
+ * regions are redrawn pixelated or blurred right after the output in the
+ * same pass. Only the mask geometry is shaded, unmasked pixels cost
+ * nothing and outputs without a mask (inference inputs) stay untouched.
+ */
+enum class mask_effect {
+  pixelate,
+  // 4x4 taps over the radius, cheaper than a real blur and just as opaque
+  blur,
+};
+
+// masking of one output spec
+struct output_mask {
+  bool enabled = false;
+  mask_effect effect = mask_effect::pixelate;
+  // block size or blur radius in output pixels
+  int size = 16;
+};
+
+// sensor pixels
+struct mask_rect {
+  float x, y, w, h;
+};
+
+/*
+ * Masked regions in sensor pixels: static zones, fixed once a stream uses
+ * them, and rectangles (e.g. detected faces) replaced at any time from any
+ * thread. submit_mask_rects swaps the new rectangles in and hands the
+ * previous ones back, double buffered like overlay_queue.
+ */
+struct privacy_masks {
+  // simple polygons, x0, y0, x1, y1, ... in either winding
+  std::vector<std::vector<float>> zones;
+  std::mutex mutex;
+  std::vector<mask_rect> rects;
+  uint64_t version = 0;
+};
+
+void submit_mask_rects(privacy_masks &masks, std::vector<mask_rect> &rects);
+
+struct mask_renderer {
+  // triangles of the zones in sensor pixels, x, y per vertex
+  std::vector<float> zone_tris;
+  std::vector<mask_rect> rects;
+  // of the rects, ~0 until the first update
+  uint64_t version = ~0ull;
+  // clip space x, y per vertex
+  GLuint vbo = 0;
+  std::vector<float> vertices;
+  // vertex range of every output, see add_mask_target
+  std::vector<int> first, count;
+};
+
+// triangulates the zones of `masks`
+bool create_mask_renderer(mask_renderer &r, const privacy_masks &masks);
+
+/*
+ * Copies the rects of `masks` when they changed and clears the targets,
+ * the caller then adds them again and uploads. False when nothing changed.
+ */
+bool update_masks(mask_renderer &r, privacy_masks &masks);
+
+/*
+ * Adds the triangles of all masks for a `w` x `h` output whose pixels map
+ * to sensor pixels through `transform`, returns the target index.
+ */
+int add_mask_target(mask_renderer &r, const frame_transform &transform, int w,
+                    int h);
+void upload_masks(mask_renderer &r);
+
+// draws `target` with the bound program, leaves the fullscreen quad bound
+void draw_mask_geometry(mask_renderer &r, int target);
@@ -0,0 +1,170 @@
+#include "mosaic.hpp"
+#include "common.h"
+#include "downscale.hpp"
+#include <cmath>
+#include <drm/drm_fourcc.h>
+#include <stdio.h>
+#include <unistd.h>
+
+// every cell of a pass in one draw call each, the cameras on units 0..n-1
+static void draw_mosaic_pass(mosaic_stream &mosaic, int p,
+                             const graph_pass_context &ctx) {
+  graph_pass_context cell_ctx = ctx;
+  for (size_t c = 0; c < mosaic.cells.size(); c++) {
+    const auto &cell = mosaic.cells[c];
+    // the cell samples unit 0 like a single output
+    cell_ctx.inputs = {ctx.inputs[c]};
+    draw_output_region(mosaic.spec.cell, mosaic.layouts[c],
+                       mosaic.sources[c], mosaic.progs[p], p, cell.x, cell.y,
+                       mosaic.w, mosaic.h, cell_ctx);
+  }
+}
+
+mosaic_stream create_mosaic_stream(const v4l2_device_info &dev,
+                                   const v4l2_dma_device_info &dma,
+                                   EGLDisplay disp, const mosaic_spec &spec,
+                                   const std::vector<int> &in_w,
+                                   const std::vector<int> &in_h,
+                                   int num_slots) {
+  const auto &cell = spec.cell;
+  if (spec.cameras < 1 || (int)in_w.size() < spec.cameras ||
+      (int)in_h.size() < spec.cameras) {
+    printf("Mosaic needs the capture size of all %d cameras\n", spec.cameras);
+    return {};
+  }
+  // packed formats pack 4 pixels per texel, NV12 subsamples 2x2
+  if (cell.w % 4 != 0 || cell.h % 2 != 0) {
+    printf("Mosaic cells have to be multiples of 4x2, not %dx%d\n", cell.w,
+           cell.h);
+    return {};
+  }
+  if (cell.drm_format == FORMAT_RGB_CHW &&
+      spec.arrangement == mosaic_arrangement::stacked) {
+    printf("Planar mosaics can't be stacked, the planes span all cells\n");
+    return {};
+  }
+  if (cell.norm.enabled && cell.drm_format == DRM_FORMAT_NV12) {
+    printf("Normalization is not supported for NV12 outputs\n");
+    return {};
+  }
+
+  mosaic_stream out;
+  out.spec = spec;
+  int cols = 1;
+  if (spec.arrangement == mosaic_arrangement::grid)
+    cols = spec.cols > 0 ? spec.cols
+                         : (int)std::ceil(std::sqrt((float)spec.cameras));
+  int rows = (spec.cameras + cols - 1) / cols;
+  out.w = cols * cell.w;
+  out.h = rows * cell.h;
+  out.frames = create_egl_frame(dev, dma, disp, num_slots, out.w, out.h,
+                                cell.drm_format);
+  if (out.frames.size() != (size_t)num_slots) {
+    printf("Failed to create mosaic %dx%d\n", out.w, out.h);
+    return {};
+  }
+
+  output_spec frame_spec = cell;
+  frame_spec.w = out.w;
+  frame_spec.h = out.h;
+  auto tensor = describe_output_tensor(frame_spec);
+  if (spec.arrangement == mosaic_arrangement::stacked) {
+    tensor.dims[0] = spec.cameras;
+    tensor.dims[2] = cell.h;
+    tensor.strides[0] = tensor.strides[2] * cell.h;
+  }
+  for (auto &frame : out.frames)
+    frame.tensor = tensor;
+
+  auto &graph = out.graph;
+  for (int c = 0; c < spec.cameras; c++) {
+    auto layout = compute_output_layout(cell, in_w[c], in_h[c]);
+    mosaic_cell m;
+    m.camera = c;
+    m.x = (c % cols) * cell.w;
+    m.y = (c / cols) * cell.h;
+    m.w = cell.w;
+    m.h = cell.h;
+    // the layout is relative to the cell
+    m.transform = layout.transform;
+    m.transform.offset_x -= m.x * m.transform.scale_x;
+    m.transform.offset_y -= m.y * m.transform.scale_y;
+    out.cells.push_back(m);
+    out.layouts.push_back(layout);
+
+    int res = import_graph_texture(graph, "camera" + std::to_string(c),
+                                   GL_TEXTURE_EXTERNAL_OES);
+    out.input_res.push_back(res);
+    output_source src;
+    src.res = res;
+    src.uv = layout.uv;
+    src.texel_w = 1.0f / in_w[c];
+    src.texel_h = 1.0f / in_h[c];
+    out.sources.push_back(src);
+  }
+
+  // cells are single pass, the plain filter of output_downscale::none
+  auto plan = plan_downscale(output_downscale::none, in_w[0], in_h[0],
+                             cell.w, cell.h);
+  auto variants =
+      output_pass_variants(cell, shader_input::external, plan.filter);
+  precompile_variants(variants);
+  auto passes = output_format_passes(cell.drm_format);
+  for (size_t p = 0; p < passes.size(); p++) {
+    out.progs.push_back(load_output_prog(get_variant_program(variants[p])));
+    auto name = "mosaic." + std::to_string(p);
+    int target = import_graph_target(
+        graph, name, output_pass_bytes_per_pixel(cell.drm_format, passes[p]));
+    out.target_res.push_back(target);
+    int id = add_graph_pass(graph, name, out.input_res, target,
+                            [p](const graph_pass_context &ctx) {
+                              draw_mosaic_pass(*(mosaic_stream *)ctx.user, p,
+                                               ctx);
+                            });
+    // letterbox bars and unused cells
+    graph.passes[id].load = graph_load_op::clear;
+    output_pass_clear_color(cell, p, graph.passes[id].clear_color);
+  }
+  if (!compile_render_graph(graph))
+    return {};
+  printf("Mosaic: %d cameras in %dx%d, %dx%d cells\n", spec.cameras, out.w,
+         out.h, cell.w, cell.h);
+  return out;
+}
+
+egl_frame_fence render_mosaic(EGLDisplay disp, mosaic_stream &mosaic,
+                              const std::vector<GLuint> &camera_tex,
+                              int slot) {
+  for (size_t c = 0; c < mosaic.input_res.size(); c++)
+    bind_graph_texture(mosaic.graph, mosaic.input_res[c], camera_tex[c]);
+  auto &frame = mosaic.frames[slot];
+  for (size_t p = 0; p < mosaic.target_res.size(); p++) {
+    if (frame.planes.empty())
+      bind_graph_target(mosaic.graph, mosaic.target_res[p], frame.fb,
+                        frame.w, frame.h);
+    else
+      bind_graph_target(mosaic.graph, mosaic.target_res[p],
+                        frame.planes[p].fb, frame.planes[p].w,
+                        frame.planes[p].h);
+  }
+  execute_render_graph(mosaic.graph, &mosaic);
+
+  egl_frame_fence batch = create_frame_fence(disp, -1);
+  destroy_frame_fence(disp, frame.fence);
+  frame.fence.fd =
+      batch.fd >= 0 ? dup(batch.fd) : export_dmabuf_fence(frame.fd);
+  return batch;
+}
+
+int map_mosaic_point(const mosaic_stream &mosaic, float x, float y,
+                     float &sensor_x, float &sensor_y) {
+  for (const auto &cell : mosaic.cells) {
+    if (x < cell.x || x >= cell.x + cell.w || y < cell.y ||
+        y >= cell.y + cell.h)
+      continue;
+    sensor_x = x * cell.transform.scale_x + cell.transform.offset_x;
+    sensor_y = y * cell.transform.scale_y + cell.transform.offset_y;
+    return cell.camera;
+  }
+  return -1;
+}
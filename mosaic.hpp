@@ -0,0 +1,81 @@
+#pragma once
+
+#include "output_spec.hpp"
+#include <vector>
+
+/*
+ * One accelerator input made of the frames of several cameras: every
+ * camera is rendered into its own cell of a shared dmabuf in one
+ * submission, so a single inference call covers all of them.
+ */
+enum class mosaic_arrangement {
+  // cols x rows cells, e.g. 2x2 640x640 cells in a 1280x1280 frame
+  grid,
+  // cells on top of each other, read as a batch of N cell sized tensors
+  stacked,
+};
+
+/*
+ * `cell` describes the output of one camera: size, format, fit, pad color
+ * and preprocessing. Its crop applies to every camera, downscale and
+ * intermediates are ignored, the cells are rendered in a single pass from
+ * the captures.
+ */
+struct mosaic_spec {
+  output_spec cell;
+  int cameras = 4;
+  mosaic_arrangement arrangement = mosaic_arrangement::grid;
+  // columns of the grid, 0 picks ceil(sqrt(cameras))
+  int cols = 0;
+};
+
+/*
+ * Placement of a camera in the mosaic. `transform` maps mosaic pixels
+ * inside the cell back to the sensor pixels of `camera`.
+ */
+struct mosaic_cell {
+  int camera;
+  int x, y, w, h;
+  frame_transform transform;
+};
+
+struct mosaic_stream {
+  mosaic_spec spec;
+  int w = 0, h = 0;
+  // the transform table, cells[camera]
+  std::vector<mosaic_cell> cells;
+  std::vector<output_layout> layouts;
+  std::vector<output_source> sources;
+  std::vector<egl_dma_frame> frames;
+  // one program per pass of the cell format
+  std::vector<output_prog> progs;
+  render_graph graph;
+  std::vector<int> input_res;
+  std::vector<int> target_res;
+};
+
+/*
+ * `in_w`/`in_h` are the capture sizes of the cameras. The frames are
+ * allocated from the heap of `dma` like the output frames.
+ */
+mosaic_stream create_mosaic_stream(const v4l2_device_info &dev,
+                                   const v4l2_dma_device_info &dma,
+                                   EGLDisplay disp, const mosaic_spec &spec,
+                                   const std::vector<int> &in_w,
+                                   const std::vector<int> &in_h,
+                                   int num_slots);
+
+/*
+ * Renders the latest capture of every camera, `camera_tex[camera]`, into
+ * `slot` and fences the batch like render_output_batch.
+ */
+egl_frame_fence render_mosaic(EGLDisplay disp, mosaic_stream &mosaic,
+                              const std::vector<GLuint> &camera_tex,
+                              int slot);
+
+/*
+ * Maps a point of the mosaic to its camera and sensor coordinates, returns
+ * the camera or -1 outside every cell.
+ */
+int map_mosaic_point(const mosaic_stream &mosaic, float x, float y,
+                     float &sensor_x, float &sensor_y);
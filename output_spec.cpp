@@ -0,0 +1,801 @@
+#include "output_spec.hpp"
+#include "common.h"
+#include "downscale.hpp"
+#include "fp16_output.hpp"
+#include "gl_state.hpp"
+#include "shader_registry.hpp"
+#include <drm/drm_fourcc.h>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+output_layout compute_output_layout(const output_spec &spec, int in_w,
+                                    int in_h) {
+  output_layout out;
+  out.uv = spec.crop;
+  out.vp_x = 0;
+  out.vp_y = 0;
+  out.vp_w = spec.w;
+  out.vp_h = spec.h;
+
+  float crop_w = spec.crop.w * in_w;
+  float crop_h = spec.crop.h * in_h;
+  if (spec.fit == output_fit::letterbox) {
+    float s = std::min(spec.w / crop_w, spec.h / crop_h);
+    out.vp_w = std::min(spec.w, (int)std::lround(crop_w * s));
+    out.vp_h = std::min(spec.h, (int)std::lround(crop_h * s));
+    out.vp_x = (spec.w - out.vp_w) / 2;
+    out.vp_y = (spec.h - out.vp_h) / 2;
+  } else if (spec.fit == output_fit::center_crop) {
+    float s = std::max(spec.w / crop_w, spec.h / crop_h);
+    float vis_w = spec.w / s / in_w;
+    float vis_h = spec.h / s / in_h;
+    out.uv.x = spec.crop.x + (spec.crop.w - vis_w) * 0.5f;
+    out.uv.y = spec.crop.y + (spec.crop.h - vis_h) * 0.5f;
+    out.uv.w = vis_w;
+    out.uv.h = vis_h;
+  }
+
+  // derived from the rounded viewport so the mapping is exact
+  auto &xf = out.transform;
+  xf.scale_x = out.uv.w * in_w / out.vp_w;
+  xf.scale_y = out.uv.h * in_h / out.vp_h;
+  xf.offset_x = out.uv.x * in_w - out.vp_x * xf.scale_x;
+  xf.offset_y = out.uv.y * in_h - out.vp_y * xf.scale_y;
+  return out;
+}
+
+std::vector<output_pass> output_format_passes(int drm_format) {
+  if (drm_format == DRM_FORMAT_NV12)
+    return {output_pass::y, output_pass::uv};
+  if (drm_format == DRM_FORMAT_RGB888)
+    return {output_pass::pack_rgb};
+  if (drm_format == DRM_FORMAT_R8)
+    return {output_pass::pack_r};
+  if (drm_format == FORMAT_RGB_CHW)
+    return {output_pass::pack_r, output_pass::pack_r, output_pass::pack_r};
+  return {output_pass::rgb};
+}
+
+static const char *pass_defines(output_pass pass) {
+  switch (pass) {
+  case output_pass::y:
+    return "#define OUTPUT_Y\n";
+  case output_pass::uv:
+    return "#define OUTPUT_UV\n";
+  case output_pass::pack_rgb:
+    return "#define OUTPUT_PACK_RGB\n";
+  case output_pass::pack_r:
+    return "#define OUTPUT_PACK_R\n";
+  default:
+    return "";
+  }
+}
+
+static const float luma_weights[3] = {0.2126f, 0.7152f, 0.0722f};
+static const float chw_weights[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+
+// weights of the channel a single channel pass writes
+static const float *pass_channel(int drm_format, int plane) {
+  if (drm_format == FORMAT_RGB_CHW)
+    return chw_weights[plane];
+  return luma_weights;
+}
+
+int output_pass_bytes_per_pixel(int drm_format, output_pass pass) {
+  switch (pass) {
+  case output_pass::y:
+    return 1;
+  case output_pass::uv:
+    return 2;
+  case output_pass::rgb:
+    // the readback fallback renders RGBA8 instead, close enough
+    return drm_format == DRM_FORMAT_ABGR16161616F ? 8 : 4;
+  default:
+    return 4;
+  }
+}
+
+// clear color of a pass, matches the conversion in simple.frag
+static void pass_clear_color(output_pass pass, const float *channel,
+                             const float *rgba, float *out) {
+  float r = rgba[0], g = rgba[1], b = rgba[2];
+  float y = 0.2126f * r + 0.7152f * g + 0.0722f * b;
+  out[0] = r;
+  out[1] = g;
+  out[2] = b;
+  out[3] = rgba[3];
+  switch (pass) {
+  case output_pass::y:
+    out[0] = y;
+    out[1] = out[2] = 0;
+    break;
+  case output_pass::uv:
+    out[0] = (b - y) / 1.8556f + 0.5f;
+    out[1] = (r - y) / 1.5748f + 0.5f;
+    out[2] = 0;
+    break;
+  case output_pass::pack_rgb:
+    // bytewise, only exact for gray pads
+    out[3] = r;
+    break;
+  case output_pass::pack_r:
+    out[0] = channel[0] * r + channel[1] * g + channel[2] * b;
+    out[1] = out[2] = out[3] = out[0];
+    break;
+  default:
+    break;
+  }
+}
+
+// q = x * a + b folds (x - mean) / std / scale + zero_point
+static void quantize_params(const output_norm &n, float *a, float *b) {
+  for (int c = 0; c < 3; c++) {
+    a[c] = 1.0f / (n.std[c] * n.scale);
+    b[c] = n.zero_point - n.mean[c] * a[c];
+  }
+}
+
+// CPU side of preprocess_channel() in simple.frag
+static float quantize_channel(const output_norm &norm, const float *w,
+                              float x) {
+  float a[3], b[3];
+  quantize_params(norm, a, b);
+  float q = std::floor(x * (w[0] * a[0] + w[1] * a[1] + w[2] * a[2]) +
+                       w[0] * b[0] + w[1] * b[1] + w[2] * b[2] + 0.5f);
+  q = std::min(std::max(q, norm.is_signed ? -128.0f : 0.0f),
+               norm.is_signed ? 127.0f : 255.0f);
+  if (q < 0)
+    q += 256;
+  return q / 255.0f;
+}
+
+// CPU side of quantize() in simple.frag, used for clear colors
+static void quantize_color(const output_norm &norm, const float *rgba,
+                           float *out) {
+  float lo = norm.is_signed ? -128 : 0;
+  float hi = norm.is_signed ? 127 : 255;
+  for (int c = 0; c < 3; c++) {
+    float n = (rgba[c] - norm.mean[c]) / norm.std[c];
+    float q = std::floor(n / norm.scale + norm.zero_point + 0.5f);
+    q = std::min(std::max(q, lo), hi);
+    if (q < 0)
+      q += 256;
+    out[c] = q / 255.0f;
+  }
+  out[3] = rgba[3];
+}
+
+// luma intermediates drop the color, only luma outputs can use them
+static output_intermediates spec_intermediates(const output_spec &spec) {
+  if (spec.intermediates == output_intermediates::luma &&
+      spec.drm_format != DRM_FORMAT_R8)
+    return output_intermediates::fast;
+  return spec.intermediates;
+}
+
+static output_preprocess spec_preprocess(const output_spec &spec) {
+  if (spec.drm_format == DRM_FORMAT_ABGR16161616F) {
+    // the cpu mode normalizes while converting
+    return get_fp16_mode() == fp16_mode::cpu ? output_preprocess::none
+                                              : output_preprocess::normalize;
+  }
+  return spec.norm.enabled ? output_preprocess::quantize
+                           : output_preprocess::none;
+}
+
+static const char *preprocess_defines(output_preprocess pre) {
+  switch (pre) {
+  case output_preprocess::quantize:
+    return "#define OUTPUT_QUANT\n";
+  case output_preprocess::normalize:
+    return "#define OUTPUT_NORM\n";
+  default:
+    return "";
+  }
+}
+
+tensor_desc describe_output_tensor(const output_spec &spec) {
+  tensor_desc t;
+  t.dtype = spec.norm.is_signed ? tensor_dtype::int8 : tensor_dtype::uint8;
+  int c = 1, elem = 1;
+  bool planar = false;
+  switch (spec.drm_format) {
+  case DRM_FORMAT_RG88:
+    c = 2;
+    break;
+  case DRM_FORMAT_RGB888:
+    c = 3;
+    break;
+  case DRM_FORMAT_RGBA8888:
+    c = 4;
+    break;
+  case FORMAT_RGB_CHW:
+    c = 3;
+    planar = true;
+    break;
+  case DRM_FORMAT_ABGR16161616F:
+    c = 4;
+    elem = 2;
+    t.dtype = tensor_dtype::fp16;
+    break;
+  default:
+    // R8, and the Y plane of NV12
+    break;
+  }
+  t.dims[0] = 1;
+  t.dims[1] = c;
+  t.dims[2] = spec.h;
+  t.dims[3] = spec.w;
+  t.strides[0] = c * spec.w * spec.h * elem;
+  if (planar) {
+    t.strides[1] = spec.w * spec.h * elem;
+    t.strides[2] = spec.w * elem;
+    t.strides[3] = elem;
+  } else {
+    t.strides[1] = elem;
+    t.strides[2] = spec.w * c * elem;
+    t.strides[3] = c * elem;
+  }
+  return t;
+}
+
+static bool is_packed(output_pass pass) {
+  return pass == output_pass::pack_rgb || pass == output_pass::pack_r;
+}
+
+bool load_model_descriptor(const char *path, output_spec &spec) {
+  std::ifstream file(path);
+  if (!file) {
+    printf("Failed to open model descriptor %s\n", path);
+    return false;
+  }
+  spec.norm.enabled = true;
+  // resolved after parsing, fp16 overrides the layout in any line order
+  int layout_format = spec.drm_format;
+  bool fp16 = false;
+  std::string line;
+  int line_no = 0;
+  while (std::getline(file, line)) {
+    line_no++;
+    line = line.substr(0, line.find('#'));
+    size_t eq = line.find('=');
+    if (eq == std::string::npos) {
+      if (line.find_first_not_of(" \t\r") != std::string::npos)
+        printf("%s:%d: expected key = value\n", path, line_no);
+      continue;
+    }
+    std::istringstream key_in(line.substr(0, eq));
+    std::istringstream in(line.substr(eq + 1));
+    std::string key, value;
+    key_in >> key;
+    if (key == "width") {
+      in >> spec.w;
+    } else if (key == "height") {
+      in >> spec.h;
+    } else if (key == "layout") {
+      in >> value;
+      if (value == "nhwc")
+        layout_format = DRM_FORMAT_RGB888;
+      else if (value == "nchw")
+        layout_format = FORMAT_RGB_CHW;
+      else if (value == "rgba")
+        layout_format = DRM_FORMAT_RGBA8888;
+      else
+        printf("%s:%d: unknown layout %s\n", path, line_no, value.c_str());
+    } else if (key == "fit") {
+      in >> value;
+      if (value == "stretch")
+        spec.fit = output_fit::stretch;
+      else if (value == "letterbox")
+        spec.fit = output_fit::letterbox;
+      else if (value == "center_crop")
+        spec.fit = output_fit::center_crop;
+      else
+        printf("%s:%d: unknown fit %s\n", path, line_no, value.c_str());
+    } else if (key == "pad") {
+      in >> spec.pad_color[0] >> spec.pad_color[1] >> spec.pad_color[2];
+    } else if (key == "mean") {
+      in >> spec.norm.mean[0] >> spec.norm.mean[1] >> spec.norm.mean[2];
+    } else if (key == "std") {
+      in >> spec.norm.std[0] >> spec.norm.std[1] >> spec.norm.std[2];
+    } else if (key == "scale") {
+      in >> spec.norm.scale;
+    } else if (key == "zero_point") {
+      in >> spec.norm.zero_point;
+    } else if (key == "dtype") {
+      in >> value;
+      if (value == "uint8" || value == "int8") {
+        spec.norm.is_signed = value == "int8";
+        fp16 = false;
+      } else if (value == "fp16") {
+        fp16 = true;
+      } else
+        printf("%s:%d: unknown dtype %s\n", path, line_no, value.c_str());
+    } else if (key == "intermediates") {
+      in >> value;
+      if (value == "exact")
+        spec.intermediates = output_intermediates::exact;
+      else if (value == "fast")
+        spec.intermediates = output_intermediates::fast;
+      else if (value == "luma")
+        spec.intermediates = output_intermediates::luma;
+      else
+        printf("%s:%d: unknown intermediates %s\n", path, line_no,
+               value.c_str());
+    } else if (key == "downscale") {
+      in >> value;
+      if (value == "none")
+        spec.downscale = output_downscale::none;
+      else if (value == "area")
+        spec.downscale = output_downscale::area;
+      else if (value == "lanczos")
+        spec.downscale = output_downscale::lanczos;
+      else
+        printf("%s:%d: unknown downscale %s\n", path, line_no,
+               value.c_str());
+    } else {
+      printf("%s:%d: unknown key %s\n", path, line_no, key.c_str());
+      continue;
+    }
+    if (in.fail()) {
+      printf("%s:%d: bad value for %s\n", path, line_no, key.c_str());
+      return false;
+    }
+  }
+  if (spec.w <= 0 || spec.h <= 0) {
+    printf("%s: bad size %dx%d\n", path, spec.w, spec.h);
+    return false;
+  }
+  spec.drm_format = fp16 ? DRM_FORMAT_ABGR16161616F : layout_format;
+  return true;
+}
+
+output_prog load_output_prog(GLuint id) {
+  output_prog prog;
+  prog.prog = id;
+  prog.crop_loc = glGetUniformLocation(id, "u_crop");
+  prog.texel_loc = glGetUniformLocation(id, "u_texel");
+  prog.pack_loc = glGetUniformLocation(id, "u_pack");
+  prog.pad_loc = glGetUniformLocation(id, "u_pad");
+  prog.channel_loc = glGetUniformLocation(id, "u_channel");
+  prog.quant_a_loc = glGetUniformLocation(id, "u_quant_a");
+  prog.quant_b_loc = glGetUniformLocation(id, "u_quant_b");
+  prog.quant_range_loc = glGetUniformLocation(id, "u_quant_range");
+  prog.quant_signed_loc = glGetUniformLocation(id, "u_quant_signed");
+  prog.mask_map_loc = glGetUniformLocation(id, "u_mask_map");
+  prog.mask_loc = glGetUniformLocation(id, "u_mask");
+  return prog;
+}
+
+// binds `prog` and sets up sampling of `src`
+static void use_source(const output_spec &spec, const output_prog &prog,
+                       const output_source &src,
+                       const graph_pass_context &ctx) {
+  // only the capture follows the spec, intermediates are always linear
+  if (src.input == shader_input::external)
+    gl_state_texture_filter(0, GL_TEXTURE_EXTERNAL_OES, ctx.inputs[0],
+                            spec.filter);
+  gl_state_use_program(prog.prog);
+  GL_CHECK(glUniform2f(prog.texel_loc, src.texel_w, src.texel_h));
+}
+
+// intermediate pass of a downscale, fills the whole target
+static void draw_filter_pass(output_stream &stream, int s,
+                             const output_prog &prog,
+                             const output_source &src,
+                             const graph_pass_context &ctx) {
+  use_source(stream.specs[s], prog, src, ctx);
+  GL_CHECK(glUniform4f(prog.crop_loc, src.uv.x, src.uv.y, src.uv.w,
+                       src.uv.h));
+  GL_CHECK(glDrawArrays(GL_TRIANGLES, 0, 6));
+}
+
+void use_output_prog(const output_spec &spec, const output_prog &prog,
+                     const output_source &src,
+                     const graph_pass_context &ctx) {
+  auto pre = spec_preprocess(spec);
+  use_source(spec, prog, src, ctx);
+  if (pre == output_preprocess::normalize) {
+    const auto &n = spec.norm;
+    float a[3] = {1, 1, 1}, b[3] = {0, 0, 0};
+    for (int c = 0; n.enabled && c < 3; c++) {
+      a[c] = 1.0f / n.std[c];
+      b[c] = -n.mean[c] / n.std[c];
+    }
+    GL_CHECK(glUniform3fv(prog.quant_a_loc, 1, a));
+    GL_CHECK(glUniform3fv(prog.quant_b_loc, 1, b));
+  } else if (pre == output_preprocess::quantize) {
+    const auto &n = spec.norm;
+    float a[3], b[3];
+    quantize_params(n, a, b);
+    GL_CHECK(glUniform3fv(prog.quant_a_loc, 1, a));
+    GL_CHECK(glUniform3fv(prog.quant_b_loc, 1, b));
+    GL_CHECK(glUniform2f(prog.quant_range_loc, n.is_signed ? -128 : 0,
+                         n.is_signed ? 127 : 255));
+    GL_CHECK(glUniform1f(prog.quant_signed_loc, n.is_signed));
+  }
+}
+
+void draw_output_region(const output_spec &spec, const output_layout &layout,
+                        const output_source &src, const output_prog &prog,
+                        int p, int x, int y, int frame_w, int frame_h,
+                        const graph_pass_context &ctx) {
+  auto passes = output_format_passes(spec.drm_format);
+  use_output_prog(spec, prog, src, ctx);
+  float sx = (float)ctx.w / frame_w;
+  float sy = (float)ctx.h / frame_h;
+  int vp_x = x + layout.vp_x, vp_y = y + layout.vp_y;
+  if (is_packed(passes[p])) {
+    // texels at the content edges are partly padding, the shader
+    // resolves those per output pixel
+    int x0 = std::floor(vp_x * sx);
+    int x1 = std::ceil((vp_x + layout.vp_w) * sx);
+    gl_state_viewport(x0, vp_y, x1 - x0, layout.vp_h);
+    GL_CHECK(glUniform4f(prog.pack_loc, vp_x, layout.vp_w, 0, 0));
+    GL_CHECK(glUniform4fv(prog.pad_loc, 1, spec.pad_color));
+    GL_CHECK(
+        glUniform3fv(prog.channel_loc, 1, pass_channel(spec.drm_format, p)));
+  } else {
+    gl_state_viewport(vp_x * sx, vp_y * sy, layout.vp_w * sx,
+                      layout.vp_h * sy);
+  }
+  GL_CHECK(
+      glUniform4f(prog.crop_loc, src.uv.x, src.uv.y, src.uv.w, src.uv.h));
+  GL_CHECK(glDrawArrays(GL_TRIANGLES, 0, 6));
+}
+
+// redraws the masked regions of the content of spec `s`
+static void draw_output_masks(output_stream &stream, int s, int p,
+                              const graph_pass_context &ctx) {
+  int target = stream.mask_targets[s];
+  if (target < 0 || stream.mask_draw.count[target] == 0)
+    return;
+  const auto &spec = stream.specs[s];
+  const auto &layout = stream.layouts[s];
+  const auto &src = stream.sources[s];
+  const auto &prog = stream.mask_progs[s][p];
+  use_output_prog(spec, prog, src, ctx);
+  // target pixels per output pixel, 0.5 for the chroma plane
+  float sx = (float)ctx.w / spec.w, sy = (float)ctx.h / spec.h;
+  float ax = src.uv.w / (layout.vp_w * sx);
+  float ay = src.uv.h / (layout.vp_h * sy);
+  GL_CHECK(glUniform4f(prog.mask_map_loc, ax, ay,
+                       src.uv.x - layout.vp_x * sx * ax,
+                       src.uv.y - layout.vp_y * sy * ay));
+  GL_CHECK(glUniform1f(prog.mask_loc, spec.mask.size * sx));
+  // the mask vertices cover the whole output, the scissor keeps the
+  // padding of letterboxed outputs as it is
+  gl_state_viewport(0, 0, ctx.w, ctx.h);
+  gl_state_scissor(layout.vp_x * sx, layout.vp_y * sy, layout.vp_w * sx,
+                   layout.vp_h * sy);
+  draw_mask_geometry(stream.mask_draw, target);
+  gl_state_disable_scissor();
+}
+
+static void draw_output_pass(output_stream &stream, int s, int p,
+                             const graph_pass_context &ctx) {
+  const auto &spec = stream.specs[s];
+  draw_output_region(spec, stream.layouts[s], stream.sources[s],
+                     stream.progs[s][p], p, 0, 0, spec.w, spec.h, ctx);
+  if (stream.masks && !stream.mask_progs[s].empty())
+    draw_output_masks(stream, s, p, ctx);
+  if (stream.overlay)
+    draw_overlay(stream.overlay_draw, stream.overlay_targets[s], ctx.w,
+                 ctx.h);
+}
+
+static downscale_plan spec_downscale_plan(const output_stream &stream,
+                                         int s) {
+  const auto &layout = stream.layouts[s];
+  return plan_downscale(stream.specs[s].downscale,
+                        std::lround(layout.uv.w * stream.in_w),
+                        std::lround(layout.uv.h * stream.in_h), layout.vp_w,
+                        layout.vp_h);
+}
+
+std::vector<shader_variant> output_pass_variants(const output_spec &spec,
+                                                 shader_input input,
+                                                 const std::string &filter) {
+  auto pre = spec_preprocess(spec);
+  std::vector<shader_variant> variants;
+  for (auto pass : output_format_passes(spec.drm_format)) {
+    shader_variant variant;
+    variant.input = input;
+    variant.filter = filter;
+    variant.defines = pass_defines(pass);
+    variant.defines += preprocess_defines(pre);
+    variants.push_back(variant);
+  }
+  return variants;
+}
+
+void output_pass_clear_color(const output_spec &spec, int p, float *out) {
+  auto pre = spec_preprocess(spec);
+  auto passes = output_format_passes(spec.drm_format);
+  const float *channel = pass_channel(spec.drm_format, p);
+  if (pre == output_preprocess::quantize &&
+      passes[p] == output_pass::pack_r) {
+    const float *c = spec.pad_color;
+    float x = channel[0] * c[0] + channel[1] * c[1] + channel[2] * c[2];
+    std::fill(out, out + 4, quantize_channel(spec.norm, channel, x));
+    return;
+  }
+  float pad[4];
+  std::copy(spec.pad_color, spec.pad_color + 4, pad);
+  if (pre == output_preprocess::quantize) {
+    quantize_color(spec.norm, spec.pad_color, pad);
+  } else if (pre == output_preprocess::normalize && spec.norm.enabled) {
+    // OUTPUT_NORM, the half float target stores (x - mean) / std as is
+    for (int c = 0; c < 3; c++)
+      pad[c] = (pad[c] - spec.norm.mean[c]) / spec.norm.std[c];
+  }
+  pass_clear_color(passes[p], channel, pad, out);
+}
+
+// shader variants of the output passes of spec `s` and of the downscale
+// passes before them
+static std::vector<shader_variant> spec_variants(const output_stream &stream,
+                                                 int s) {
+  const auto &spec = stream.specs[s];
+  auto plan = spec_downscale_plan(stream, s);
+  std::vector<shader_variant> variants;
+  shader_variant filter;
+  // luma intermediates are written like the Y plane
+  shader_input intermediate = shader_input::tex2d;
+  if (spec_intermediates(spec) == output_intermediates::luma) {
+    filter.defines = pass_defines(output_pass::y);
+    intermediate = shader_input::luma2d;
+  }
+  if (plan.prescale) {
+    filter.filter = "bilinear";
+    variants.push_back(filter);
+    filter.input = intermediate;
+  }
+  if (!plan.h_filter.empty()) {
+    filter.filter = plan.h_filter;
+    variants.push_back(filter);
+    filter.input = intermediate;
+  }
+  auto passes = output_pass_variants(spec, filter.input, plan.filter);
+  variants.insert(variants.end(), passes.begin(), passes.end());
+  if (spec.mask.enabled) {
+    // the masks sample what the output passes sample
+    auto masks = output_pass_variants(spec, filter.input, "bilinear");
+    for (auto &mask : masks) {
+      mask.defines += "#define MASK\n";
+      if (spec.mask.effect == mask_effect::blur)
+        mask.defines += "#define MASK_BLUR\n";
+    }
+    variants.insert(variants.end(), masks.begin(), masks.end());
+  }
+  return variants;
+}
+
+// adds an intermediate pass reading `src`, returns the new source
+static output_source add_filter_pass(output_stream &stream, int s,
+                                     const std::string &name,
+                                     const output_source &src,
+                                     const shader_variant &variant, int w,
+                                     int h) {
+  auto policy = spec_intermediates(stream.specs[s]);
+  auto desc = intermediate_desc(policy, w, h);
+  int res = create_graph_texture(stream.graph, name, desc);
+  auto prog = load_output_prog(get_variant_program(variant));
+  add_graph_pass(stream.graph, name, {src.res}, res,
+                 [s, prog, src](const graph_pass_context &ctx) {
+                   draw_filter_pass(*(output_stream *)ctx.user, s, prog, src,
+                                    ctx);
+                 });
+  output_source out;
+  out.res = res;
+  out.texel_w = 1.0f / w;
+  out.texel_h = 1.0f / h;
+  out.input = policy == output_intermediates::luma ? shader_input::luma2d
+                                                   : shader_input::tex2d;
+  return out;
+}
+
+static bool build_output_graph(output_stream &stream) {
+  auto &graph = stream.graph;
+  stream.input_res =
+      import_graph_texture(graph, "capture", GL_TEXTURE_EXTERNAL_OES);
+  for (size_t s = 0; s < stream.specs.size(); s++) {
+    auto base = "out" + std::to_string(s);
+    auto plan = spec_downscale_plan(stream, s);
+    auto variants = spec_variants(stream, s);
+    size_t v = 0;
+    output_source src;
+    src.res = stream.input_res;
+    src.uv = stream.layouts[s].uv;
+    src.texel_w = 1.0f / stream.in_w;
+    src.texel_h = 1.0f / stream.in_h;
+    if (plan.prescale) {
+      src = add_filter_pass(stream, s, base + ".pre", src, variants[v++],
+                            plan.pre_w, plan.pre_h);
+    }
+    if (!plan.h_filter.empty()) {
+      src = add_filter_pass(stream, s, base + ".h", src, variants[v++],
+                            plan.h_w, plan.h_h);
+    }
+    if (plan.mode != output_downscale::none)
+      printf("Output %zu: %s downscale, %.2fM fetches per frame\n", s,
+             plan.mode == output_downscale::area ? "area" : "lanczos",
+             plan.fetches / 1e6f);
+    if (plan.prescale || !plan.h_filter.empty()) {
+      auto policy = spec_intermediates(stream.specs[s]);
+      printf("Output %zu: %s intermediates, %.2fMB per frame saved\n", s,
+             intermediate_format_name(intermediate_desc(policy, 1, 1)),
+             intermediate_bytes_saved(plan, policy) / 1048576);
+    }
+    stream.sources.push_back(src);
+
+    std::vector<int> targets;
+    std::vector<output_prog> progs;
+    const auto &spec = stream.specs[s];
+    auto passes = output_format_passes(spec.drm_format);
+    for (size_t p = 0; p < passes.size(); p++) {
+      progs.push_back(load_output_prog(get_variant_program(variants[v++])));
+      auto name = base + "." + std::to_string(p);
+      int target = import_graph_target(
+          graph, name,
+          output_pass_bytes_per_pixel(spec.drm_format, passes[p]));
+      targets.push_back(target);
+      int id = add_graph_pass(graph, name, {src.res}, target,
+                              [s, p](const graph_pass_context &ctx) {
+                                draw_output_pass(*(output_stream *)ctx.user,
+                                                 s, p, ctx);
+                              });
+      if (spec.fit == output_fit::letterbox) {
+        // pad regions come from the clear, the draw only covers the content
+        graph.passes[id].load = graph_load_op::clear;
+        output_pass_clear_color(spec, p, graph.passes[id].clear_color);
+      }
+    }
+    stream.progs.push_back(progs);
+    stream.target_res.push_back(targets);
+    std::vector<output_prog> mask_progs;
+    for (size_t p = 0; spec.mask.enabled && p < passes.size(); p++)
+      mask_progs.push_back(
+          load_output_prog(get_variant_program(variants[v++])));
+    stream.mask_progs.push_back(mask_progs);
+  }
+  return compile_render_graph(graph);
+}
+
+output_stream create_output_stream(const v4l2_device_info &dev,
+                                   const v4l2_dma_device_info &dma,
+                                   EGLDisplay disp,
+                                   const std::vector<output_spec> &specs,
+                                   int num_slots, overlay_queue *overlay,
+                                   privacy_masks *masks) {
+  output_stream out;
+  out.specs = specs;
+  out.num_slots = num_slots;
+  int in_w = dev.fmt.fmt.pix_mp.width;
+  int in_h = dev.fmt.fmt.pix_mp.height;
+  out.in_w = in_w;
+  out.in_h = in_h;
+  for (auto &spec : specs) {
+    if (spec.norm.enabled && spec.drm_format == DRM_FORMAT_NV12) {
+      printf("Normalization is not supported for NV12 outputs\n");
+      return {};
+    }
+    if (spec.overlay && (spec.norm.enabled ||
+                         output_format_passes(spec.drm_format).size() != 1 ||
+                         output_format_passes(spec.drm_format)[0] !=
+                             output_pass::rgb)) {
+      printf("Overlays need an unpacked RGB output without normalization\n");
+      return {};
+    }
+    if (spec.mask.enabled && spec.mask.size < 1) {
+      printf("Mask size has to be at least 1 pixel\n");
+      return {};
+    }
+    for (auto pass : output_format_passes(spec.drm_format)) {
+      if (spec.mask.enabled && (pass == output_pass::pack_rgb ||
+                                pass == output_pass::pack_r)) {
+        printf("Masks are not supported for packed outputs\n");
+        return {};
+      }
+    }
+    auto frames = create_egl_frame(dev, dma, disp, num_slots, spec.w, spec.h,
+                                   spec.drm_format);
+    if (frames.size() != (size_t)num_slots) {
+      printf("Failed to create output %dx%d\n", spec.w, spec.h);
+      return {};
+    }
+    auto layout = compute_output_layout(spec, in_w, in_h);
+    auto tensor = describe_output_tensor(spec);
+    for (auto &frame : frames) {
+      frame.transform = layout.transform;
+      frame.tensor = tensor;
+    }
+    out.layouts.push_back(layout);
+    out.frames.push_back(frames);
+  }
+
+  // collect every variant the specs need and build them in one batch
+  std::vector<shader_variant> variants;
+  for (size_t s = 0; s < specs.size(); s++) {
+    auto spec_vars = spec_variants(out, s);
+    variants.insert(variants.end(), spec_vars.begin(), spec_vars.end());
+  }
+  precompile_variants(variants);
+  if (!build_output_graph(out)) {
+    return {};
+  }
+  out.overlay_targets.assign(specs.size(), -1);
+  if (overlay) {
+    out.overlay = overlay;
+    if (!create_overlay_renderer(out.overlay_draw))
+      return {};
+  }
+  out.mask_targets.assign(specs.size(), -1);
+  if (masks) {
+    out.masks = masks;
+    if (!create_mask_renderer(out.mask_draw, *masks))
+      return {};
+  }
+  return out;
+}
+
+egl_frame_fence render_output_batch(EGLDisplay disp, output_stream &stream,
+                                    GLuint input_tex, int slot) {
+  if (stream.overlay && update_overlay(stream.overlay_draw, *stream.overlay)) {
+    for (size_t s = 0; s < stream.specs.size(); s++) {
+      const auto &spec = stream.specs[s];
+      stream.overlay_targets[s] =
+          spec.overlay ? add_overlay_target(stream.overlay_draw,
+                                            stream.layouts[s].transform,
+                                            spec.w, spec.h)
+                       : -1;
+    }
+    upload_overlay(stream.overlay_draw);
+  }
+  if (stream.masks && update_masks(stream.mask_draw, *stream.masks)) {
+    for (size_t s = 0; s < stream.specs.size(); s++) {
+      const auto &spec = stream.specs[s];
+      stream.mask_targets[s] =
+          spec.mask.enabled ? add_mask_target(stream.mask_draw,
+                                              stream.layouts[s].transform,
+                                              spec.w, spec.h)
+                            : -1;
+    }
+    upload_masks(stream.mask_draw);
+  }
+  bind_graph_texture(stream.graph, stream.input_res, input_tex);
+  for (size_t s = 0; s < stream.specs.size(); s++) {
+    const auto &frame = stream.frames[s][slot];
+    const auto &targets = stream.target_res[s];
+    for (size_t p = 0; p < targets.size(); p++) {
+      if (frame.planes.empty()) {
+        bind_graph_target(stream.graph, targets[p], frame.fb, frame.w,
+                          frame.h);
+      } else {
+        const auto &plane = frame.planes[p];
+        bind_graph_target(stream.graph, targets[p], plane.fb, plane.w,
+                          plane.h);
+      }
+    }
+  }
+  execute_render_graph(stream.graph, &stream);
+
+  // after all draws are queued, glReadPixels waits for the GPU
+  for (size_t s = 0; s < stream.specs.size(); s++) {
+    if (stream.specs[s].drm_format == DRM_FORMAT_ABGR16161616F)
+      read_back_fp16(stream.frames[s][slot], stream.specs[s].norm);
+  }
+
+  egl_frame_fence batch = create_frame_fence(disp, -1);
+  for (auto &frames : stream.frames) {
+    auto &frame = frames[slot];
+    destroy_frame_fence(disp, frame.fence);
+    frame.fence.fd =
+        batch.fd >= 0 ? dup(batch.fd) : export_dmabuf_fence(frame.fd);
+  }
+  return batch;
+}
@@ -0,0 +1,240 @@
+#pragma once
+
+#include "egl_sync.hpp"
+#include "mask.hpp"
+#include "overlay.hpp"
+#include "render_graph.hpp"
+#include "shader_registry.hpp"
+#include "v4l2_device.hpp"
+#include <vector>
+
+// region of the input in normalized texture coordinates
+struct output_crop {
+  float x = 0, y = 0, w = 1, h = 1;
+};
+
+enum class output_fit {
+  // fill the whole output, ignores the aspect ratio
+  stretch,
+  // keep the aspect ratio, pad with `pad_color`
+  letterbox,
+  // keep the aspect ratio, cut the overhanging part of the input
+  center_crop,
+};
+
+// how the input is reduced to the output size, see downscale.hpp
+enum class output_downscale {
+  // one pass of the sharpening filter straight from the capture
+  none,
+  // box average over the footprint of every output pixel
+  area,
+  // separable Lanczos2, horizontal then vertical
+  lanczos,
+};
+
+/*
+ * Format of the intermediate targets of multi-pass downscales, see
+ * intermediate_desc in downscale.hpp.
+ */
+enum class output_intermediates {
+  // RGBA8888
+  exact,
+  // RGB565, half the bandwidth, 5-6 bits per channel
+  fast,
+  // luma only in an R8 target, for outputs that only use luma
+  // (DRM_FORMAT_R8), others fall back to fast
+  luma,
+};
+
+/*
+ * Model preprocessing applied in the fragment stage: per channel
+ * (x - mean) / std on x in [0, 1], then quantized to
+ * round(n / scale) + zero_point and stored as uint8 or two's complement
+ * int8. Applies to the RGB based outputs, not to NV12. fp16 outputs
+ * (DRM_FORMAT_ABGR16161616F) only normalize, `scale` and `zero_point` are
+ * ignored.
+ */
+struct output_norm {
+  bool enabled = false;
+  float mean[3] = {0, 0, 0};
+  float std[3] = {1, 1, 1};
+  float scale = 1.0f / 255;
+  int zero_point = 0;
+  bool is_signed = false;
+};
+
+/*
+ * `crop` is the explicit ROI of the input, the fit mode is applied to it.
+ */
+struct output_spec {
+  int w, h;
+  int drm_format;
+  output_crop crop;
+  GLenum filter = GL_LINEAR;
+  output_fit fit = output_fit::stretch;
+  // RGB888 outputs are cleared bytewise, their pad color has to be gray
+  float pad_color[4] = {0, 0, 0, 1};
+  output_norm norm;
+  output_downscale downscale = output_downscale::none;
+  output_intermediates intermediates = output_intermediates::exact;
+  // draws the overlay of the stream on top, for unpacked RGB outputs
+  // without normalization (previews)
+  bool overlay = false;
+  // privacy masks of the stream, for unpacked outputs (RGBA, NV12)
+  output_mask mask;
+};
+
+/*
+ * Reads a model descriptor, a text file of `key = values` lines ('#'
+ * starts a comment) into `spec`. Keys: width, height, layout (nhwc, nchw,
+ * rgba), fit (stretch, letterbox, center_crop), pad, mean, std, scale,
+ * zero_point, dtype (uint8, int8, fp16), downscale (none, area, lanczos),
+ * intermediates (exact, fast, luma).
+ * fp16 always uses the RGBA half float layout, whatever the line order.
+ * Fails on a non-positive width or height.
+ */
+bool load_model_descriptor(const char *path, output_spec &spec);
+
+// shader variant of one render pass of an output
+enum class output_pass {
+  rgb,
+  // BT.709 full range luma into R
+  y,
+  // BT.709 full range chroma into RG, rendered at half resolution
+  uv,
+  // RGB888 packed into an RGBA8888 target 3/4 of the width
+  pack_rgb,
+  // one channel (luma or R/G/B of a planar tensor) packed 4 pixels per
+  // RGBA8888 texel
+  pack_r,
+  count,
+};
+
+// per channel math applied before the output is written
+enum class output_preprocess {
+  none,
+  // (x - mean) / std, quantized to uint8/int8
+  quantize,
+  // (x - mean) / std as float, for half float targets
+  normalize,
+  count,
+};
+
+struct output_prog {
+  GLuint prog = 0;
+  GLint crop_loc = -1;
+  GLint texel_loc = -1;
+  GLint pack_loc = -1;
+  GLint pad_loc = -1;
+  GLint channel_loc = -1;
+  GLint quant_a_loc = -1;
+  GLint quant_b_loc = -1;
+  GLint quant_range_loc = -1;
+  GLint quant_signed_loc = -1;
+  GLint mask_map_loc = -1;
+  GLint mask_loc = -1;
+};
+
+// passes needed to fill a frame of `drm_format`, one per egl_dma_frame plane
+std::vector<output_pass> output_format_passes(int drm_format);
+output_prog load_output_prog(GLuint id);
+// of the render target of a pass, for the bandwidth estimates
+int output_pass_bytes_per_pixel(int drm_format, output_pass pass);
+// programs of the passes of `spec`, sampling `input` through `filter`
+std::vector<shader_variant> output_pass_variants(const output_spec &spec,
+                                                 shader_input input,
+                                                 const std::string &filter);
+// pad color of pass `p` as written by the pass, for the target clear
+void output_pass_clear_color(const output_spec &spec, int p, float *out);
+
+// what the output passes of a spec sample: the capture or the last
+// intermediate of its downscale passes
+struct output_source {
+  int res = -1;
+  output_crop uv;
+  // 1 / size of the sampled texture
+  float texel_w = 0, texel_h = 0;
+  shader_input input = shader_input::external;
+};
+
+// resolved placement of a spec, computed once per stream
+struct output_layout {
+  int vp_x, vp_y, vp_w, vp_h;
+  output_crop uv;
+  frame_transform transform;
+};
+
+output_layout compute_output_layout(const output_spec &spec, int in_w,
+                                    int in_h);
+tensor_desc describe_output_tensor(const output_spec &spec);
+
+/*
+ * Binds the program of a pass with the sampling of `src` and the
+ * preprocessing uniforms of `spec`, the state before a draw.
+ */
+void use_output_prog(const output_spec &spec, const output_prog &prog,
+                     const output_source &src,
+                     const graph_pass_context &ctx);
+
+/*
+ * Draws pass `p` of `spec` with its content at `x`, `y` of a `frame_w` x
+ * `frame_h` frame, the whole frame when the spec covers it. Outputs
+ * sharing one frame (mosaic cells) each draw their own region, `x` has to
+ * be a multiple of 4 for packed formats. The padding comes from the clear
+ * of the target.
+ */
+void draw_output_region(const output_spec &spec, const output_layout &layout,
+                        const output_source &src, const output_prog &prog,
+                        int p, int x, int y, int frame_w, int frame_h,
+                        const graph_pass_context &ctx);
+
+/*
+ * Every spec of a stream is rendered from the same capture frame in one
+ * batch. frames[spec][slot] holds the output buffers, a slot is reused
+ * once the consumer is done with it.
+ *
+ * The passes are nodes of `graph`, reading the imported capture texture
+ * `input_res` and writing the imported plane targets
+ * `target_res[spec][plane]`, which are rebound to the slot every batch.
+ */
+struct output_stream {
+  std::vector<output_spec> specs;
+  std::vector<output_layout> layouts;
+  std::vector<std::vector<egl_dma_frame>> frames;
+  int num_slots = 0;
+  int in_w = 0, in_h = 0;
+  // programs of the output passes, progs[spec][plane]
+  std::vector<std::vector<output_prog>> progs;
+  std::vector<output_source> sources;
+  render_graph graph;
+  int input_res = -1;
+  std::vector<std::vector<int>> target_res;
+  // latest list of `overlay`, drawn over the specs with `overlay` set
+  overlay_queue *overlay = nullptr;
+  overlay_renderer overlay_draw;
+  // per spec, -1 without one
+  std::vector<int> overlay_targets;
+  // masks of the specs with `mask` enabled, drawn before the overlay
+  privacy_masks *masks = nullptr;
+  mask_renderer mask_draw;
+  std::vector<int> mask_targets;
+  // programs of the mask draws, mask_progs[spec][plane], empty unmasked
+  std::vector<std::vector<output_prog>> mask_progs;
+};
+
+output_stream create_output_stream(const v4l2_device_info &dev,
+                                   const v4l2_dma_device_info &dma,
+                                   EGLDisplay disp,
+                                   const std::vector<output_spec> &specs,
+                                   int num_slots,
+                                   overlay_queue *overlay = nullptr,
+                                   privacy_masks *masks = nullptr);
+
+/*
+ * Renders all specs of `stream` into `slot` from the external texture
+ * `input_tex` with shared state setup, then inserts a single fence for the
+ * whole batch. Every frame of the slot gets its own fd of that fence, the
+ * returned batch fence is owned by the caller.
+ */
+egl_frame_fence render_output_batch(EGLDisplay disp, output_stream &stream,
+                                    GLuint input_tex, int slot);
@@ -0,0 +1,197 @@
+#include "overlay.hpp"
+#include "common.h"
+#include "gl_state.hpp"
+#include "shader.hpp"
+#include "shader_registry.hpp"
+#include "stb_image.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <utility>
+
+#define INCBIN_PREFIX font_
+#define INCBIN_STYLE INCBIN_STYLE_SNAKE
+#include "incbin.h"
+
+// FONT_DIR is set by CMake to the absolute source path
+INCBIN(glyphs_png, FONT_DIR "/glyphs.png");
+
+// the unit the glyph atlas is bound to, the capture stays on unit 0
+static const int glyph_unit = 1;
+
+void submit_overlay(overlay_queue &queue, overlay_list &list) {
+  std::lock_guard<std::mutex> lock(queue.mutex);
+  std::swap(queue.latest, list);
+  queue.version++;
+}
+
+bool load_glyph_atlas(glyph_atlas &atlas, const char *path) {
+  int w, h, n;
+  stbi_uc *data;
+  if (path)
+    data = stbi_load(path, &w, &h, &n, 1);
+  else
+    data = stbi_load_from_memory(font_glyphs_png_data, font_glyphs_png_size,
+                                 &w, &h, &n, 1);
+  if (!data) {
+    printf("Failed to load the glyph atlas %s\n", path ? path : "");
+    return false;
+  }
+  atlas.w = w;
+  atlas.h = h;
+  atlas.cell_w = w / atlas.cols;
+  atlas.cell_h = h / atlas.rows;
+  GL_CHECK(glGenTextures(1, &atlas.tex));
+  gl_state_bind_texture(glyph_unit, GL_TEXTURE_2D, atlas.tex);
+  // rows of a one channel image are not 4 byte aligned in general
+  GL_CHECK(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+  GL_CHECK(glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, w, h, 0,
+                        GL_LUMINANCE, GL_UNSIGNED_BYTE, data));
+  GL_CHECK(glPixelStorei(GL_UNPACK_ALIGNMENT, 4));
+  GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+  GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+  gl_state_texture_filter(glyph_unit, GL_TEXTURE_2D, atlas.tex, GL_LINEAR);
+  stbi_image_free(data);
+  return true;
+}
+
+bool create_overlay_renderer(overlay_renderer &r) {
+  if (!load_glyph_atlas(r.glyphs, getenv("EGL_MALI_GLYPH_ATLAS")))
+    return false;
+  shader_variant variant;
+  variant.vert = "overlay.vert";
+  variant.frag = "overlay.frag";
+  variant.input = shader_input::tex2d;
+  variant.filter = "bilinear";
+  r.prog = get_variant_program(variant);
+  r.glyphs_loc = glGetUniformLocation(r.prog, "s_glyphs");
+  GL_CHECK(glGenBuffers(1, &r.vbo));
+  return true;
+}
+
+bool update_overlay(overlay_renderer &r, overlay_queue &queue) {
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.version == r.version)
+      return false;
+    r.current = queue.latest;
+    r.version = queue.version;
+  }
+  r.vertices.clear();
+  r.first.clear();
+  r.count.clear();
+  return true;
+}
+
+// output pixels to clip space, atlas pixels to texture coordinates
+static void add_quad(overlay_renderer &r, int w, int h, float x0, float y0,
+                     float x1, float y1, float u0, float v0, float u1,
+                     float v1, const float *color) {
+  const auto &g = r.glyphs;
+  float cx0 = x0 / w * 2 - 1, cx1 = x1 / w * 2 - 1;
+  float cy0 = y0 / h * 2 - 1, cy1 = y1 / h * 2 - 1;
+  u0 /= g.w;
+  u1 /= g.w;
+  v0 /= g.h;
+  v1 /= g.h;
+  float corners[6][4] = {{cx0, cy0, u0, v0}, {cx1, cy0, u1, v0},
+                         {cx0, cy1, u0, v1}, {cx0, cy1, u0, v1},
+                         {cx1, cy0, u1, v0}, {cx1, cy1, u1, v1}};
+  for (auto &corner : corners) {
+    r.vertices.insert(r.vertices.end(), corner, corner + 4);
+    r.vertices.insert(r.vertices.end(), color, color + 4);
+  }
+}
+
+// filled rectangle, all corners sample the middle of the solid cell
+static void add_rect(overlay_renderer &r, int w, int h, float x0, float y0,
+                     float x1, float y1, const float *color) {
+  const auto &g = r.glyphs;
+  int solid = g.num_chars - 1;
+  float u = (solid % g.cols + 0.5f) * g.cell_w;
+  float v = (solid / g.cols + 0.5f) * g.cell_h;
+  add_quad(r, w, h, x0, y0, x1, y1, u, v, u, v, color);
+}
+
+static void add_text(overlay_renderer &r, int w, int h, float x, float y,
+                     float scale, const std::string &text,
+                     const float *color) {
+  const auto &g = r.glyphs;
+  float gw = g.cell_w * scale, gh = g.cell_h * scale;
+  for (char c : text) {
+    int i = (unsigned char)c - g.first_char;
+    if (i < 0 || i >= g.num_chars - 1)
+      i = '?' - g.first_char;
+    // spaces are empty cells, no need to draw them
+    if (c != ' ') {
+      float u = (i % g.cols) * g.cell_w, v = (i / g.cols) * g.cell_h;
+      add_quad(r, w, h, x, y, x + gw, y + gh, u, v, u + g.cell_w,
+               v + g.cell_h, color);
+    }
+    x += gw;
+  }
+}
+
+int add_overlay_target(overlay_renderer &r, const frame_transform &transform,
+                       int w, int h) {
+  const auto &list = r.current;
+  int first = r.vertices.size() / 8;
+  float lw = list.line_width;
+  float gw = r.glyphs.cell_w * list.text_scale;
+  float gh = r.glyphs.cell_h * list.text_scale;
+  for (const auto &box : list.boxes) {
+    // sensor = output * scale + offset
+    float x0 = (box.x - transform.offset_x) / transform.scale_x;
+    float y0 = (box.y - transform.offset_y) / transform.scale_y;
+    float x1 = (box.x + box.w - transform.offset_x) / transform.scale_x;
+    float y1 = (box.y + box.h - transform.offset_y) / transform.scale_y;
+    add_rect(r, w, h, x0, y0, x1, y0 + lw, box.color);
+    add_rect(r, w, h, x0, y1 - lw, x1, y1, box.color);
+    add_rect(r, w, h, x0, y0 + lw, x0 + lw, y1 - lw, box.color);
+    add_rect(r, w, h, x1 - lw, y0 + lw, x1, y1 - lw, box.color);
+    if (box.label.empty())
+      continue;
+    // above the box, inside it at the top edge of the output
+    float ly = y0 - gh >= 0 ? y0 - gh : y0;
+    const float black[4] = {0, 0, 0, 1};
+    add_rect(r, w, h, x0, ly, x0 + box.label.size() * gw, ly + gh,
+             box.color);
+    add_text(r, w, h, x0, ly, list.text_scale, box.label, black);
+  }
+  for (const auto &text : list.texts)
+    add_text(r, w, h, text.x, text.y, list.text_scale, text.text,
+             text.color);
+  r.first.push_back(first);
+  r.count.push_back(r.vertices.size() / 8 - first);
+  return r.first.size() - 1;
+}
+
+void upload_overlay(overlay_renderer &r) {
+  if (r.vertices.empty())
+    return;
+  // orphans the previous contents, the GPU may still read them
+  gl_state_bind_array_buffer(r.vbo);
+  GL_CHECK(glBufferData(GL_ARRAY_BUFFER, r.vertices.size() * sizeof(float),
+                        r.vertices.data(), GL_STREAM_DRAW));
+}
+
+void draw_overlay(overlay_renderer &r, int target, int w, int h) {
+  if (target < 0 || r.count[target] == 0)
+    return;
+  // the output pass leaves the content rect of letterboxed outputs bound
+  gl_state_viewport(0, 0, w, h);
+  gl_state_use_program(r.prog);
+  gl_state_bind_texture(glyph_unit, GL_TEXTURE_2D, r.glyphs.tex);
+  GL_CHECK(glUniform1i(r.glyphs_loc, glyph_unit));
+  gl_state_bind_array_buffer(r.vbo);
+  gl_state_vertex_attrib(ATTRIB_POS, 4, GL_FLOAT, 8 * sizeof(float), 0);
+  gl_state_vertex_attrib(ATTRIB_COLOR, 4, GL_FLOAT, 8 * sizeof(float),
+                         4 * sizeof(float));
+  GL_CHECK(glEnable(GL_BLEND));
+  // the alpha of the output stays
+  GL_CHECK(glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ZERO,
+                               GL_ONE));
+  GL_CHECK(glDrawArrays(GL_TRIANGLES, r.first[target], r.count[target]));
+  GL_CHECK(glDisable(GL_BLEND));
+  gl_state_disable_vertex_attrib(ATTRIB_COLOR);
+  gl_state_bind_fullscreen_quad();
+}
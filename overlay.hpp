@@ -0,0 +1,112 @@
+#pragma once
+
+#include "glad/gles2.h"
+#include "v4l2_device.hpp"
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+ * Detection boxes, labels and text burned into preview outputs on the GPU.
+ * Everything of one output is a single draw of textured quads: glyphs
+ * come from a prebuilt atlas, box edges sample its solid cell.
+ */
+struct overlay_box {
+  // sensor pixels, every output maps them through its transform
+  float x, y, w, h;
+  float color[4] = {0, 1, 0, 1};
+  // drawn on a bar of the box color above the box, empty for none
+  std::string label;
+};
+
+struct overlay_text {
+  // output pixels from the top left corner
+  float x, y;
+  float color[4] = {1, 1, 1, 1};
+  std::string text;
+};
+
+struct overlay_list {
+  std::vector<overlay_box> boxes;
+  // e.g. the timestamp
+  std::vector<overlay_text> texts;
+  // in output pixels
+  float line_width = 2;
+  // glyph size in output pixels is the atlas cell size times this
+  float text_scale = 1;
+};
+
+/*
+ * Hand-over from the thread producing the overlays (e.g. the inference
+ * thread) to the render threads. submit_overlay swaps the new list in, the
+ * producer gets the previous one back to fill next: the two lists are
+ * double buffered and neither side waits on the other for longer than a
+ * swap or a copy. Render threads pick up the latest list at the start of a
+ * batch and keep drawing it until a newer one arrives.
+ */
+struct overlay_queue {
+  std::mutex mutex;
+  overlay_list latest;
+  // number of the latest list, 0 before the first
+  uint64_t version = 0;
+};
+
+void submit_overlay(overlay_queue &queue, overlay_list &list);
+
+/*
+ * ASCII `first_char` .. `first_char + num_chars - 2` in a grid of
+ * `cols` cells per row, the last cell is solid. load_glyph_atlas reads a
+ * PNG in this layout, the cell size is derived from its size. Without a
+ * path the embedded atlas, DejaVu Sans Mono in 12x24 cells (see
+ * fonts/LICENSE.DejaVu), is used.
+ */
+struct glyph_atlas {
+  GLuint tex = 0;
+  int w = 0, h = 0;
+  int cell_w = 0, cell_h = 0;
+  int cols = 16, rows = 6;
+  int first_char = 32, num_chars = 96;
+};
+
+bool load_glyph_atlas(glyph_atlas &atlas, const char *path = nullptr);
+
+struct overlay_renderer {
+  glyph_atlas glyphs;
+  GLuint prog = 0;
+  GLint glyphs_loc = -1;
+  // pos.xy, uv, color per vertex, 6 vertices per quad
+  GLuint vbo = 0;
+  std::vector<float> vertices;
+  // vertex range of every output, see add_overlay_target
+  std::vector<int> first, count;
+  // the list the vertices were built from
+  overlay_list current;
+  uint64_t version = 0;
+};
+
+// the glyph atlas is loaded from $EGL_MALI_GLYPH_ATLAS when set
+bool create_overlay_renderer(overlay_renderer &r);
+
+/*
+ * Copies the latest list of `queue` when it is newer than the current one
+ * and clears the targets, the caller then adds them again and uploads.
+ * False when nothing changed.
+ */
+bool update_overlay(overlay_renderer &r, overlay_queue &queue);
+
+/*
+ * Adds the quads of the current list for a `w` x `h` output whose pixels
+ * map to sensor pixels through `transform`, returns the target index.
+ */
+int add_overlay_target(overlay_renderer &r, const frame_transform &transform,
+                       int w, int h);
+void upload_overlay(overlay_renderer &r);
+
+/*
+ * Blends `target` onto the bound `w` x `h` framebuffer with a full
+ * viewport, also over the padding of letterboxed outputs, within the pass
+ * that wrote it so the tiles aren't loaded again. Leaves the fullscreen
+ * quad bound.
+ */
+void draw_overlay(overlay_renderer &r, int target, int w, int h);
@@ -0,0 +1,323 @@
+#include "render_graph.hpp"
+#include "common.h"
+#include "fp16_output.hpp"
+#include "gl_state.hpp"
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+
+typedef void(GLAD_API_PTR *PFNGLDISCARDFRAMEBUFFEREXTPROC)(
+    GLenum target, GLsizei numAttachments, const GLenum *attachments);
+
+// null without GL_EXT_discard_framebuffer, stores then can't be skipped
+static PFNGLDISCARDFRAMEBUFFEREXTPROC get_discard_framebuffer() {
+  static PFNGLDISCARDFRAMEBUFFEREXTPROC discard =
+      gl_has_extension("GL_EXT_discard_framebuffer")
+          ? (PFNGLDISCARDFRAMEBUFFEREXTPROC)eglGetProcAddress(
+                "glDiscardFramebufferEXT")
+          : nullptr;
+  return discard;
+}
+
+static int texel_bytes(const graph_texture_desc &desc) {
+  int channels = desc.format == GL_RGBA ? 4 : desc.format == GL_RGB ? 3 : 1;
+  if (desc.format == GL_LUMINANCE_ALPHA)
+    channels = 2;
+  switch (desc.type) {
+  case GL_HALF_FLOAT_OES:
+    return channels * 2;
+  case GL_FLOAT:
+    return channels * 4;
+  case GL_UNSIGNED_SHORT_5_6_5:
+  case GL_UNSIGNED_SHORT_4_4_4_4:
+  case GL_UNSIGNED_SHORT_5_5_5_1:
+    return 2;
+  }
+  return channels;
+}
+
+int import_graph_texture(render_graph &graph, const std::string &name,
+                         GLenum target) {
+  graph_resource res;
+  res.name = name;
+  res.kind = graph_resource_kind::imported_texture;
+  res.target = target;
+  graph.resources.push_back(res);
+  return graph.resources.size() - 1;
+}
+
+int import_graph_target(render_graph &graph, const std::string &name,
+                        int bytes_per_pixel) {
+  graph_resource res;
+  res.name = name;
+  res.kind = graph_resource_kind::imported_target;
+  res.bytes_per_pixel = bytes_per_pixel;
+  graph.resources.push_back(res);
+  return graph.resources.size() - 1;
+}
+
+int create_graph_texture(render_graph &graph, const std::string &name,
+                         const graph_texture_desc &desc) {
+  graph_resource res;
+  res.name = name;
+  res.kind = graph_resource_kind::transient;
+  res.desc = desc;
+  res.w = desc.w;
+  res.h = desc.h;
+  res.bytes_per_pixel = texel_bytes(desc);
+  graph.resources.push_back(res);
+  return graph.resources.size() - 1;
+}
+
+void bind_graph_texture(render_graph &graph, int res, GLuint tex) {
+  graph.resources[res].tex = tex;
+}
+
+void bind_graph_target(render_graph &graph, int res, GLuint fb, int w,
+                       int h) {
+  auto &r = graph.resources[res];
+  r.fb = fb;
+  r.w = w;
+  r.h = h;
+}
+
+int add_graph_pass(render_graph &graph, const std::string &name,
+                   const std::vector<int> &inputs, int output,
+                   std::function<void(const graph_pass_context &)> execute) {
+  graph_pass pass;
+  pass.name = name;
+  pass.inputs = inputs;
+  pass.output = output;
+  pass.execute = execute;
+  graph.passes.push_back(pass);
+  return graph.passes.size() - 1;
+}
+
+static bool same_desc(const graph_texture_desc &a,
+                      const graph_texture_desc &b) {
+  return a.w == b.w && a.h == b.h && a.format == b.format && a.type == b.type;
+}
+
+static bool create_pool_entry(graph_pool_entry &entry) {
+  GL_CHECK(glGenTextures(1, &entry.tex));
+  GL_CHECK(glBindTexture(GL_TEXTURE_2D, entry.tex));
+  GL_CHECK(glTexImage2D(GL_TEXTURE_2D, 0, entry.desc.format, entry.desc.w,
+                        entry.desc.h, 0, entry.desc.format, entry.desc.type,
+                        nullptr));
+  GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+  GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+  GL_CHECK(
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+  GL_CHECK(
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+  GL_CHECK(glGenFramebuffers(1, &entry.fb));
+  GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, entry.fb));
+  GL_CHECK(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                  GL_TEXTURE_2D, entry.tex, 0));
+  GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+  if (status != GL_FRAMEBUFFER_COMPLETE) {
+    printf("Intermediate %dx%d format 0x%x type 0x%x is not renderable\n",
+           entry.desc.w, entry.desc.h, entry.desc.format, entry.desc.type);
+    return false;
+  }
+  return true;
+}
+
+bool compile_render_graph(render_graph &graph) {
+  int num_res = graph.resources.size();
+  int num_passes = graph.passes.size();
+  std::vector<int> producer(num_res, -1);
+  for (int p = 0; p < num_passes; p++) {
+    int out = graph.passes[p].output;
+    if (graph.resources[out].kind == graph_resource_kind::imported_texture) {
+      printf("Pass %s writes the input %s\n", graph.passes[p].name.c_str(),
+             graph.resources[out].name.c_str());
+      return false;
+    }
+    if (producer[out] >= 0) {
+      printf("%s is written by %s and %s\n",
+             graph.resources[out].name.c_str(),
+             graph.passes[producer[out]].name.c_str(),
+             graph.passes[p].name.c_str());
+      return false;
+    }
+    producer[out] = p;
+  }
+
+  // Kahn's algorithm, ready passes run in declaration order so the
+  // caller's grouping of state is kept where dependencies allow it
+  std::vector<int> pending(num_passes, 0);
+  for (int p = 0; p < num_passes; p++) {
+    for (int in : graph.passes[p].inputs) {
+      if (producer[in] >= 0) {
+        pending[p]++;
+      } else if (graph.resources[in].kind == graph_resource_kind::transient) {
+        printf("Pass %s reads %s, which nothing writes\n",
+               graph.passes[p].name.c_str(),
+               graph.resources[in].name.c_str());
+        return false;
+      }
+    }
+  }
+  graph.order.clear();
+  std::vector<bool> done(num_passes, false);
+  while ((int)graph.order.size() < num_passes) {
+    int next = -1;
+    for (int p = 0; p < num_passes && next < 0; p++) {
+      if (!done[p] && pending[p] == 0)
+        next = p;
+    }
+    if (next < 0) {
+      printf("Render graph has a cycle\n");
+      return false;
+    }
+    done[next] = true;
+    graph.order.push_back(next);
+    for (int p = 0; p < num_passes; p++) {
+      for (int in : graph.passes[p].inputs) {
+        if (producer[in] == next)
+          pending[p]--;
+      }
+    }
+  }
+
+  // lifetimes as positions in the execution order
+  for (auto &res : graph.resources)
+    res.first_use = res.last_use = -1;
+  for (int i = 0; i < num_passes; i++) {
+    const auto &pass = graph.passes[graph.order[i]];
+    auto &out = graph.resources[pass.output];
+    if (out.first_use < 0)
+      out.first_use = i;
+    out.last_use = std::max(out.last_use, i);
+    for (int in : pass.inputs)
+      graph.resources[in].last_use = i;
+  }
+
+  // greedy assignment in order of first use, an entry is free once the
+  // last reader of its previous resource ran
+  for (auto &entry : graph.pool)
+    entry.busy_until = -1;
+  std::vector<int> transients;
+  for (int r = 0; r < num_res; r++) {
+    if (graph.resources[r].kind == graph_resource_kind::transient &&
+        graph.resources[r].first_use >= 0)
+      transients.push_back(r);
+  }
+  std::sort(transients.begin(), transients.end(), [&](int a, int b) {
+    return graph.resources[a].first_use < graph.resources[b].first_use;
+  });
+  for (int r : transients) {
+    auto &res = graph.resources[r];
+    res.pool_index = -1;
+    for (size_t e = 0; e < graph.pool.size() && res.pool_index < 0; e++) {
+      auto &entry = graph.pool[e];
+      if (same_desc(entry.desc, res.desc) &&
+          entry.busy_until < res.first_use)
+        res.pool_index = e;
+    }
+    if (res.pool_index < 0) {
+      graph_pool_entry entry;
+      entry.desc = res.desc;
+      if (!create_pool_entry(entry))
+        return false;
+      graph.pool.push_back(entry);
+      res.pool_index = graph.pool.size() - 1;
+    }
+    auto &entry = graph.pool[res.pool_index];
+    entry.busy_until = res.last_use;
+    res.tex = entry.tex;
+    res.fb = entry.fb;
+  }
+  // the pool setup bound textures and framebuffers directly
+  gl_state_invalidate();
+  printf("Render graph: %d passes, %d intermediates in %zu textures\n",
+         num_passes, (int)transients.size(), graph.pool.size());
+  return true;
+}
+
+void execute_render_graph(render_graph &graph, void *user) {
+  graph_pass_context ctx;
+  ctx.user = user;
+  for (int p : graph.order) {
+    auto &pass = graph.passes[p];
+    auto t0 = std::chrono::high_resolution_clock::now();
+    ctx.inputs.clear();
+    for (size_t i = 0; i < pass.inputs.size(); i++) {
+      const auto &res = graph.resources[pass.inputs[i]];
+      gl_state_bind_texture(i, res.target, res.tex);
+      ctx.inputs.push_back(res.tex);
+    }
+    const auto &out = graph.resources[pass.output];
+    ctx.fb = out.fb;
+    ctx.w = out.w;
+    ctx.h = out.h;
+    gl_state_bind_framebuffer(ctx.fb);
+    gl_state_viewport(0, 0, ctx.w, ctx.h);
+    uint64_t bytes = (uint64_t)ctx.w * ctx.h * out.bytes_per_pixel;
+    if (pass.load == graph_load_op::load) {
+      pass.load_bytes += bytes;
+    } else {
+      if (pass.load == graph_load_op::clear)
+        gl_state_clear_color(pass.clear_color[0], pass.clear_color[1],
+                             pass.clear_color[2], pass.clear_color[3]);
+      GL_CHECK(glClear(GL_COLOR_BUFFER_BIT));
+      pass.load_bytes_saved += bytes;
+    }
+    pass.execute(ctx);
+    auto discard = get_discard_framebuffer();
+    if (pass.store == graph_store_op::dont_care && discard) {
+      const GLenum color = GL_COLOR_ATTACHMENT0;
+      GL_CHECK(discard(GL_FRAMEBUFFER, 1, &color));
+      pass.store_bytes_saved += bytes;
+    } else {
+      pass.store_bytes += bytes;
+    }
+    if (graph.profile)
+      glFinish();
+    auto t1 = std::chrono::high_resolution_clock::now();
+    pass.runs++;
+    pass.total_ms += std::chrono::duration<double>(t1 - t0).count() * 1000;
+  }
+}
+
+graph_traffic get_render_graph_traffic(const render_graph &graph) {
+  graph_traffic out;
+  for (const auto &pass : graph.passes) {
+    if (pass.runs == 0)
+      continue;
+    out.bytes += (double)(pass.load_bytes + pass.store_bytes) / pass.runs;
+    out.saved +=
+        (double)(pass.load_bytes_saved + pass.store_bytes_saved) / pass.runs;
+  }
+  return out;
+}
+
+void print_render_graph_stats(const render_graph &graph) {
+  printf("Pass timings (%s), DRAM traffic of the outputs per run:\n",
+         graph.profile ? "GPU inclusive" : "submission only");
+  for (int p : graph.order) {
+    const auto &pass = graph.passes[p];
+    int n = pass.runs ? pass.runs : 1;
+    printf("  %-16s %6d runs %8.3f ms avg  load %6.1fKB store %6.1fKB "
+           "saved %6.1fKB\n",
+           pass.name.c_str(), pass.runs, pass.total_ms / n,
+           pass.load_bytes / 1024.0 / n, pass.store_bytes / 1024.0 / n,
+           (pass.load_bytes_saved + pass.store_bytes_saved) / 1024.0 / n);
+  }
+  auto traffic = get_render_graph_traffic(graph);
+  printf("  per frame: %.2fMB traffic, %.2fMB saved by load/store ops\n",
+         traffic.bytes / 1048576, traffic.saved / 1048576);
+}
+
+void destroy_render_graph(render_graph &graph) {
+  for (auto &entry : graph.pool) {
+    glDeleteFramebuffers(1, &entry.fb);
+    glDeleteTextures(1, &entry.tex);
+  }
+  graph.pool.clear();
+  graph.passes.clear();
+  graph.resources.clear();
+  graph.order.clear();
+}
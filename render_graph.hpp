@@ -0,0 +1,139 @@
+#pragma once
+
+#include "glad/gles2.h"
+#include <functional>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+ * Small render graph: passes declare the resources they read and the one
+ * they write, compile_render_graph orders them by their dependencies and
+ * assigns pooled textures to the intermediate resources. Intermediates
+ * whose lifetimes don't overlap share a texture.
+ */
+
+// size and format of an intermediate render target
+struct graph_texture_desc {
+  int w = 0, h = 0;
+  GLenum format = GL_RGBA;
+  GLenum type = GL_UNSIGNED_BYTE;
+};
+
+enum class graph_resource_kind {
+  // owned by the caller and rebound every frame with bind_graph_*
+  imported_texture,
+  imported_target,
+  // allocated from the pool of the graph
+  transient,
+};
+
+struct graph_resource {
+  std::string name;
+  graph_resource_kind kind;
+  graph_texture_desc desc;
+  GLenum target = GL_TEXTURE_2D;
+  GLuint tex = 0, fb = 0;
+  int w = 0, h = 0;
+  // of a render target, for the bandwidth estimates
+  int bytes_per_pixel = 4;
+  // set by compile_render_graph, positions in the execution order
+  int pool_index = -1;
+  int first_use = -1, last_use = -1;
+};
+
+struct graph_pass_context {
+  // input textures, bound to units 0..n-1 in declaration order
+  std::vector<GLuint> inputs;
+  // bound output with a full viewport, passes may narrow it
+  GLuint fb;
+  int w, h;
+  void *user;
+};
+
+/*
+ * What happens to the output of a pass at its start and end. Mali renders
+ * tile by tile: unless the target is cleared (or invalidated) first, every
+ * tile is read back from memory before the pass draws into it, and at the
+ * end every tile is written out unless the attachment is discarded.
+ */
+enum class graph_load_op {
+  // the pass blends onto or only partly covers the previous contents
+  load,
+  // glClear with `clear_color`
+  clear,
+  // the pass overwrites everything, glClear with whatever color is set
+  dont_care,
+};
+
+enum class graph_store_op {
+  store,
+  /*
+   * glDiscardFramebufferEXT after the pass, for scratch contents. No pass of
+   * the output graphs qualifies today: the targets are color only, and
+   * every output is either a dmabuf the consumer reads or an intermediate
+   * a later pass samples. Meant for depth/stencil or MRT scratch
+   * attachments.
+   */
+  dont_care,
+};
+
+struct graph_pass {
+  std::string name;
+  std::vector<int> inputs;
+  int output;
+  std::function<void(const graph_pass_context &)> execute;
+  graph_load_op load = graph_load_op::dont_care;
+  graph_store_op store = graph_store_op::store;
+  float clear_color[4] = {0, 0, 0, 0};
+  // accumulated by execute_render_graph
+  int runs = 0;
+  double total_ms = 0;
+  // estimated DRAM traffic of the output and what the load/store ops saved
+  uint64_t load_bytes = 0, store_bytes = 0;
+  uint64_t load_bytes_saved = 0, store_bytes_saved = 0;
+};
+
+struct graph_pool_entry {
+  graph_texture_desc desc;
+  GLuint tex = 0, fb = 0;
+  int busy_until = -1;
+};
+
+struct render_graph {
+  std::vector<graph_resource> resources;
+  std::vector<graph_pass> passes;
+  std::vector<int> order;
+  std::vector<graph_pool_entry> pool;
+  /*
+   * glFinish after every pass so the pass times include the GPU work.
+   * Without it they only cover command submission.
+   */
+  bool profile = false;
+};
+
+int import_graph_texture(render_graph &graph, const std::string &name,
+                         GLenum target = GL_TEXTURE_2D);
+int import_graph_target(render_graph &graph, const std::string &name,
+                        int bytes_per_pixel = 4);
+int create_graph_texture(render_graph &graph, const std::string &name,
+                         const graph_texture_desc &desc);
+void bind_graph_texture(render_graph &graph, int res, GLuint tex);
+void bind_graph_target(render_graph &graph, int res, GLuint fb, int w, int h);
+
+int add_graph_pass(render_graph &graph, const std::string &name,
+                   const std::vector<int> &inputs, int output,
+                   std::function<void(const graph_pass_context &)> execute);
+
+/* Sorts the passes and allocates the pool, false on cycles or bad inputs */
+bool compile_render_graph(render_graph &graph);
+void execute_render_graph(render_graph &graph, void *user = nullptr);
+// estimated DRAM traffic of the pass outputs per graph run
+struct graph_traffic {
+  double bytes = 0;
+  // avoided by the load/store ops
+  double saved = 0;
+};
+graph_traffic get_render_graph_traffic(const render_graph &graph);
+void print_render_graph_stats(const render_graph &graph);
+void destroy_render_graph(render_graph &graph);
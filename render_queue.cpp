@@ -0,0 +1,67 @@
+#include "render_queue.hpp"
+#include <chrono>
+#include <stdio.h>
+
+render_queue create_render_queue(int depth) {
+  render_queue queue;
+  queue.depth = depth < 1 ? 1 : depth;
+  return queue;
+}
+
+static void retire_oldest(EGLDisplay disp, render_queue &queue,
+                          const render_retire_fn &retire) {
+  auto &frame = queue.in_flight.front();
+  for (auto &fence : frame.fences) {
+    if (!wait_frame_fence(disp, fence))
+      printf("Fence wait failed for frame %i\n", frame.frame);
+    destroy_frame_fence(disp, fence);
+  }
+  retire(frame);
+  queue.in_flight.pop_front();
+}
+
+void reserve_render_frame(EGLDisplay disp, render_queue &queue,
+                          const render_retire_fn &retire) {
+  while ((int)queue.in_flight.size() >= queue.depth) {
+    auto t0 = std::chrono::steady_clock::now();
+    retire_oldest(disp, queue, retire);
+    auto t1 = std::chrono::steady_clock::now();
+    queue.stats.stalls++;
+    queue.stats.stall_ms +=
+        std::chrono::duration<double>(t1 - t0).count() * 1000;
+  }
+}
+
+void push_render_frame(render_queue &queue, render_queue_frame frame) {
+  queue.in_flight.push_back(std::move(frame));
+  int n = queue.in_flight.size();
+  queue.stats.submitted++;
+  queue.stats.in_flight_sum += n;
+  if (n > queue.stats.max_in_flight)
+    queue.stats.max_in_flight = n;
+}
+
+render_queue_frame *find_render_frame(render_queue &queue,
+                                      uint32_t sequence) {
+  for (auto &frame : queue.in_flight) {
+    if (frame.sequence == sequence)
+      return &frame;
+  }
+  return nullptr;
+}
+
+void drain_render_queue(EGLDisplay disp, render_queue &queue,
+                        const render_retire_fn &retire) {
+  while (!queue.in_flight.empty())
+    retire_oldest(disp, queue, retire);
+}
+
+void print_render_queue_stats(const render_queue &queue) {
+  auto &s = queue.stats;
+  if (s.submitted == 0)
+    return;
+  printf("Render queue: depth %i, effective %.2f (max %i), %llu stalls "
+         "%.2fms\n",
+         queue.depth, (double)s.in_flight_sum / s.submitted, s.max_in_flight,
+         (unsigned long long)s.stalls, s.stall_ms);
+}
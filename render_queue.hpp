@@ -0,0 +1,62 @@
+#pragma once
+
+#include "egl_sync.hpp"
+#include <deque>
+#include <functional>
+#include <stdint.h>
+#include <vector>
+
+/*
+ * Render-ahead queue: up to `depth` submitted frames may be in flight on
+ * the GPU, each tracked by the batch fences of its streams. The CPU only
+ * blocks when a new frame would exceed the depth, it then waits for the
+ * oldest frame and hands it to the retire callback, which returns its
+ * capture buffer to the driver.
+ *
+ * depth 1 is the latency mode: a frame is submitted (and flushed by its
+ * fence) as soon as it is captured and retired before the next one is
+ * rendered. Higher depths keep the GPU busy while the CPU prepares the
+ * next frame, at one frame of latency each.
+ */
+struct render_queue_frame {
+  int frame = 0;
+  int capture_index = -1;
+  std::vector<egl_frame_fence> fences;
+  // V4L2 sequence number of the capture
+  uint32_t sequence = 0;
+};
+
+struct render_queue_stats {
+  uint64_t submitted = 0;
+  // retires forced by a full queue and the time spent waiting for them
+  uint64_t stalls = 0;
+  double stall_ms = 0;
+  // frames in flight after each submit, the effective depth
+  uint64_t in_flight_sum = 0;
+  int max_in_flight = 0;
+};
+
+struct render_queue {
+  int depth = 1;
+  std::deque<render_queue_frame> in_flight;
+  render_queue_stats stats;
+};
+
+typedef std::function<void(const render_queue_frame &)> render_retire_fn;
+
+render_queue create_render_queue(int depth);
+// retires the oldest frames until another one fits
+void reserve_render_frame(EGLDisplay disp, render_queue &queue,
+                          const render_retire_fn &retire);
+void push_render_frame(render_queue &queue, render_queue_frame frame);
+/*
+ * Frame in flight rendered from capture `sequence`, nullptr once it was
+ * retired and the capture buffer requeued. Work that still reads the
+ * capture (e.g. crops of its detections) adds its fence to the frame.
+ */
+render_queue_frame *find_render_frame(render_queue &queue,
+                                      uint32_t sequence);
+// retires every frame in flight
+void drain_render_queue(EGLDisplay disp, render_queue &queue,
+                        const render_retire_fn &retire);
+void print_render_queue_stats(const render_queue &queue);
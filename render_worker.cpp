@@ -0,0 +1,109 @@
+#include "render_worker.hpp"
+#include "shader_registry.hpp"
+#include <chrono>
+#include <stdio.h>
+
+static void run_worker(render_worker *worker,
+                       const std::function<void()> *setup,
+                       std::promise<bool> *started) {
+  if (!make_current(worker->ctx)) {
+    started->set_value(false);
+    return;
+  }
+  (*setup)();
+  started->set_value(true);
+
+  for (;;) {
+    std::packaged_task<void()> job;
+    {
+      std::unique_lock<std::mutex> lock(worker->mutex);
+      worker->cv.wait(lock,
+                      [&] { return worker->stop || !worker->jobs.empty(); });
+      if (worker->jobs.empty())
+        break;
+      job = std::move(worker->jobs.front());
+      worker->jobs.pop_front();
+    }
+    job();
+  }
+  release_variant_programs();
+  eglMakeCurrent(worker->ctx.disp, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                 EGL_NO_CONTEXT);
+  eglReleaseThread();
+}
+
+render_worker_pool create_render_workers(EGLDisplay disp, EGLContext share,
+                                         int count,
+                                         const std::function<void()> &setup) {
+  render_worker_pool pool;
+  pool.disp = disp;
+  for (int i = 0; i < count; i++) {
+    std::unique_ptr<render_worker> worker(new render_worker);
+    worker->index = i;
+    worker->ctx = create_egl_context(disp, share);
+    if (worker->ctx.ctx == EGL_NO_CONTEXT) {
+      destroy_render_workers(pool);
+      return {};
+    }
+    std::promise<bool> started;
+    auto ok = started.get_future();
+    worker->thread = std::thread(run_worker, worker.get(), &setup, &started);
+    if (!ok.get()) {
+      printf("Render worker %i failed to start\n", i);
+      worker->thread.join();
+      destroy_egl_context(worker->ctx);
+      destroy_render_workers(pool);
+      return {};
+    }
+    pool.workers.push_back(std::move(worker));
+  }
+  printf("Render workers: %i\n", count);
+  return pool;
+}
+
+std::future<void> submit_render_job(render_worker &worker,
+                                    std::function<void()> job) {
+  // the stats are updated before the future is ready
+  std::packaged_task<void()> task([&worker, job] {
+    auto t0 = std::chrono::steady_clock::now();
+    job();
+    auto t1 = std::chrono::steady_clock::now();
+    worker.jobs_run++;
+    worker.busy_ms += std::chrono::duration<double>(t1 - t0).count() * 1000;
+  });
+  auto done = task.get_future();
+  {
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    worker.jobs.push_back(std::move(task));
+  }
+  worker.cv.notify_one();
+  return done;
+}
+
+render_worker &assign_render_worker(render_worker_pool &pool, int stream) {
+  return *pool.workers[stream % pool.workers.size()];
+}
+
+void print_render_worker_stats(const render_worker_pool &pool) {
+  for (auto &worker : pool.workers) {
+    printf("Render worker %i: %lu jobs, %.2fms busy", worker->index,
+           worker->jobs_run, worker->busy_ms);
+    if (worker->jobs_run)
+      printf(", %.3fms/job", worker->busy_ms / worker->jobs_run);
+    printf("\n");
+  }
+}
+
+void destroy_render_workers(render_worker_pool &pool) {
+  for (auto &worker : pool.workers) {
+    {
+      std::lock_guard<std::mutex> lock(worker->mutex);
+      worker->stop = true;
+    }
+    worker->cv.notify_one();
+    if (worker->thread.joinable())
+      worker->thread.join();
+    destroy_egl_context(worker->ctx);
+  }
+  pool = {};
+}
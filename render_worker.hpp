@@ -0,0 +1,55 @@
+#pragma once
+
+#include "egl_context.hpp"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Render threads with their own EGL context in the share group of the main
+ * context. Programs, textures, buffers and EGLImages are shared, FBOs and
+ * vertex attribute state are not: everything a worker draws with has to be
+ * created by a job on that worker. Jobs of a worker run in submission
+ * order.
+ */
+struct render_worker {
+  int index = 0;
+  egl_context ctx;
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<std::packaged_task<void()>> jobs;
+  bool stop = false;
+  // written by the worker, valid once the futures of its jobs are ready
+  unsigned long jobs_run = 0;
+  double busy_ms = 0;
+};
+
+struct render_worker_pool {
+  EGLDisplay disp = EGL_NO_DISPLAY;
+  std::vector<std::unique_ptr<render_worker>> workers;
+};
+
+/*
+ * Starts `count` workers with contexts sharing with `share`. `setup` runs
+ * on every worker once its context is current, for per context state like
+ * vertex attributes and the debug callback.
+ */
+render_worker_pool create_render_workers(EGLDisplay disp, EGLContext share,
+                                         int count,
+                                         const std::function<void()> &setup);
+
+std::future<void> submit_render_job(render_worker &worker,
+                                    std::function<void()> job);
+
+// worker of the `stream`-th stream, round robin
+render_worker &assign_render_worker(render_worker_pool &pool, int stream);
+
+void print_render_worker_stats(const render_worker_pool &pool);
+// runs the queued jobs, then stops the threads and destroys the contexts
+void destroy_render_workers(render_worker_pool &pool);
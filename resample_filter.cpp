@@ -0,0 +1,148 @@
+#include "resample_filter.hpp"
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <stdio.h>
+
+static std::map<std::string, resample_kernel> &kernels() {
+  static std::map<std::string, resample_kernel> k;
+  if (k.empty()) {
+    k["bilinear"] = {"bilinear", {{0, 0, 1}}};
+    // taps were already placed between texels, nothing left to merge
+    const float d = 0.75777156f, a = 2.90709914f;
+    const float wd = 0.37487566f, wa = -0.12487566f;
+    k["sharpen"] = {"sharpen",
+                    {{-d, -d, wd},
+                     {d, -d, wd},
+                     {d, d, wd},
+                     {-d, d, wd},
+                     {-a, 0, wa},
+                     {a, 0, wa},
+                     {0, -a, wa},
+                     {0, a, wa}}};
+    resample_kernel g = {"gaussian3", {}};
+    const float b[3] = {1, 2, 1};
+    for (int y = -1; y <= 1; y++) {
+      for (int x = -1; x <= 1; x++)
+        g.taps.push_back({(float)x, (float)y, b[x + 1] * b[y + 1] / 16});
+    }
+    k["gaussian3"] = g;
+  }
+  return k;
+}
+
+// render workers plan their downscales concurrently
+static std::mutex kernels_mutex;
+
+void register_kernel(const resample_kernel &kernel) {
+  std::lock_guard<std::mutex> lock(kernels_mutex);
+  kernels()[kernel.name] = kernel;
+}
+
+resample_kernel find_kernel(const std::string &name) {
+  std::lock_guard<std::mutex> lock(kernels_mutex);
+  auto it = kernels().find(name);
+  return it == kernels().end() ? resample_kernel{} : it->second;
+}
+
+static bool same_sign(float a, float b) {
+  return a == 0 || b == 0 || (a > 0) == (b > 0);
+}
+
+std::vector<filter_tap>
+merge_bilinear_taps(const std::vector<filter_tap> &taps) {
+  std::vector<filter_tap> out;
+  // keyed (y, x) so the first entry is the top left remaining texel
+  std::map<std::pair<int, int>, float> grid;
+  for (auto &t : taps) {
+    if (t.x == std::floor(t.x) && t.y == std::floor(t.y))
+      grid[{(int)t.y, (int)t.x}] += t.w;
+    else
+      out.push_back(t);
+  }
+  auto peek = [&](int x, int y) {
+    auto it = grid.find({y, x});
+    return it == grid.end() ? 0.0f : it->second;
+  };
+  while (!grid.empty()) {
+    int y = grid.begin()->first.first;
+    int x = grid.begin()->first.second;
+    float a = peek(x, y), b = peek(x + 1, y);
+    float c = peek(x, y + 1), d = peek(x + 1, y + 1);
+    float big = std::max(std::max(std::fabs(a), std::fabs(b)),
+                         std::max(std::fabs(c), std::fabs(d)));
+    bool signs = same_sign(a, b) && same_sign(a, c) && same_sign(a, d) &&
+                 same_sign(b, c) && same_sign(b, d) && same_sign(c, d);
+    // bilinear weights are (1-fx)(1-fy), fx(1-fy), ..., i.e. rank one
+    bool separable = std::fabs(a * d - b * c) <= 1e-6f * big * big;
+    if (signs && separable) {
+      float s = a + b + c + d;
+      out.push_back({x + (b + d) / s, y + (c + d) / s, s});
+      grid.erase({y, x});
+      grid.erase({y, x + 1});
+      grid.erase({y + 1, x});
+      grid.erase({y + 1, x + 1});
+    } else if (b != 0 && same_sign(a, b)) {
+      out.push_back({x + b / (a + b), (float)y, a + b});
+      grid.erase({y, x});
+      grid.erase({y, x + 1});
+    } else if (c != 0 && same_sign(a, c)) {
+      out.push_back({(float)x, y + c / (a + c), a + c});
+      grid.erase({y, x});
+      grid.erase({y + 1, x});
+    } else {
+      out.push_back({(float)x, (float)y, a});
+      grid.erase({y, x});
+    }
+  }
+  // zero weights come from cancelling taps
+  std::vector<filter_tap> fetches;
+  for (auto &t : out) {
+    if (t.w != 0)
+      fetches.push_back(t);
+  }
+  return fetches;
+}
+
+static std::string fmt(float v) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.8f", v);
+  return buf;
+}
+
+static std::string tap_coord(const std::string &uv, const filter_tap &t) {
+  if (t.x == 0 && t.y == 0)
+    return uv;
+  return uv + "+vec2(" + fmt(t.x) + "," + fmt(t.y) + ")*u_texel";
+}
+
+std::string generate_filter_defines(const resample_kernel &kernel,
+                                    int max_varyings) {
+  auto taps = merge_bilinear_taps(kernel.taps);
+  std::string decl, vert, fetch_taps, fetch;
+  for (size_t i = 0; i < taps.size(); i++) {
+    const auto &t = taps[i];
+    std::string w = fmt(t.w) + "*";
+    std::string sum = i == 0 ? "" : "+";
+    auto name = "v_tap" + std::to_string(i);
+    if (t.x == 0 && t.y == 0) {
+      // the center is v_uv itself
+      fetch_taps += sum + w + "texture2D(s_texture2D,v_uv).xyz";
+    } else if ((int)i < max_varyings) {
+      decl += "varying vec2 " + name + ";";
+      vert += name + "=" + tap_coord("v_uv", t) + ";";
+      fetch_taps += sum + w + "texture2D(s_texture2D," + name + ").xyz";
+    } else {
+      fetch_taps +=
+          sum + w + "texture2D(s_texture2D," + tap_coord("v_uv", t) + ").xyz";
+    }
+    fetch += sum + w + "texture2D(s_texture2D," + tap_coord("(uv)", t) +
+             ").xyz";
+  }
+  std::string defines;
+  defines += "#define FILTER_DECL " + decl + "\n";
+  defines += "#define FILTER_VERT " + vert + "\n";
+  defines += "#define FILTER_FETCH_TAPS (" + fetch_taps + ")\n";
+  defines += "#define FILTER_FETCH(uv) (" + fetch + ")\n";
+  return defines;
+}
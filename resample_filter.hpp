@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// offset in input texels from the sampled position, and its weight
+struct filter_tap {
+  float x, y, w;
+};
+
+struct resample_kernel {
+  std::string name;
+  std::vector<filter_tap> taps;
+};
+
+/*
+ * Builtin kernels: "bilinear" (one fetch), "sharpen" (the 8 tap sharpening
+ * kernel simple.frag used to hard-code) and "gaussian3" (3x3 binomial).
+ * register_kernel adds or replaces one. find_kernel returns a copy, empty
+ * when the name is unknown, since a kernel can be replaced concurrently.
+ */
+void register_kernel(const resample_kernel &kernel);
+resample_kernel find_kernel(const std::string &name);
+
+/*
+ * Merges taps at integer offsets into bilinear fetches: a 2x2 block (or a
+ * pair) of texels with weights of the same sign and a separable weight
+ * ratio is one fetch between the texels. Exact when the sampled position
+ * is a texel center, a close approximation otherwise. Fractional taps are
+ * kept as they are.
+ */
+std::vector<filter_tap> merge_bilinear_taps(const std::vector<filter_tap> &taps);
+
+/*
+ * GLSL for the shaders, as defines injected after #version (GLSL ES 1.00
+ * has no line continuation, every define is a single line):
+ * FILTER_DECL declares the tap varyings, FILTER_VERT computes them in the
+ * vertex shader, FILTER_FETCH_TAPS sums them in the fragment shader and
+ * FILTER_FETCH(uv) samples around an arbitrary position (packed outputs).
+ * The tap spacing comes from `uniform vec2 u_texel`, 1 / input size. Taps
+ * beyond `max_varyings` are computed in the fragment shader.
+ */
+std::string generate_filter_defines(const resample_kernel &kernel,
+                                    int max_varyings);
@@ -0,0 +1,344 @@
+#include "shader.hpp"
+#include "common.h"
+#include "glad/egl.h"
+#include <errno.h>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <future>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <streambuf>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+typedef void(GLAD_API_PTR *PFNGLGETPROGRAMBINARYOESPROC)(
+    GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat,
+    void *binary);
+typedef void(GLAD_API_PTR *PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+typedef void(GLAD_API_PTR *PFNGLPROGRAMBINARYOESPROC)(GLuint program,
+                                                      GLenum binaryFormat,
+                                                      const void *binary,
+                                                      GLint length);
+
+std::string read_file(const char *path) {
+  std::ifstream t(path);
+  std::string str((std::istreambuf_iterator<char>(t)),
+                  std::istreambuf_iterator<char>());
+  return str;
+}
+
+std::string inject_defines(const std::string &src, const char *defines) {
+  if (defines == nullptr || defines[0] == '\0')
+    return src;
+  // #version has to stay the first line
+  size_t pos = 0;
+  if (src.compare(0, 8, "#version") == 0) {
+    pos = src.find('\n');
+    pos = pos == std::string::npos ? src.size() : pos + 1;
+  }
+  return src.substr(0, pos) + defines + "\n" + src.substr(pos);
+}
+
+struct pending_prog {
+  GLuint prog = 0, vs = 0, fs = 0;
+};
+
+// issues compile and link without waiting, so the driver can overlap them
+static pending_prog start_compile(const std::string &vert_src,
+                                  const std::string &frag_src) {
+  pending_prog p;
+  p.vs = glCreateShader(GL_VERTEX_SHADER);
+  const char *ptr = vert_src.data();
+  glShaderSource(p.vs, 1, &ptr, NULL);
+  glCompileShader(p.vs);
+  p.fs = glCreateShader(GL_FRAGMENT_SHADER);
+  ptr = frag_src.data();
+  glShaderSource(p.fs, 1, &ptr, NULL);
+  glCompileShader(p.fs);
+  // link shaders
+  p.prog = glCreateProgram();
+  glAttachShader(p.prog, p.vs);
+  glAttachShader(p.prog, p.fs);
+  // every program shares the fullscreen quad attribute setup
+  glBindAttribLocation(p.prog, ATTRIB_POS, "pos");
+  glBindAttribLocation(p.prog, ATTRIB_COLOR, "color");
+  glLinkProgram(p.prog);
+  return p;
+}
+
+static GLuint finish_compile(const pending_prog &p) {
+  int success;
+  char infoLog[512];
+  glGetProgramiv(p.prog, GL_LINK_STATUS, &success);
+  if (!success) {
+    // check for shader compile errors
+    glGetShaderiv(p.vs, GL_COMPILE_STATUS, &success);
+    if (!success) {
+      GLint logLength;
+      glGetShaderiv(p.vs, GL_INFO_LOG_LENGTH, &logLength);
+      glGetShaderInfoLog(p.vs, 512, NULL, infoLog);
+      std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n"
+                << logLength << "\n"
+                << infoLog << std::endl;
+      exit(1);
+    }
+    glGetShaderiv(p.fs, GL_COMPILE_STATUS, &success);
+    if (!success) {
+      glGetShaderInfoLog(p.fs, 512, NULL, infoLog);
+      std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n"
+                << infoLog << std::endl;
+      exit(1);
+    }
+    glGetProgramInfoLog(p.prog, 512, NULL, infoLog);
+    std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n"
+              << infoLog << std::endl;
+    exit(1);
+  }
+
+  std::cout << "Compiling Success \n";
+  glDeleteShader(p.vs);
+  glDeleteShader(p.fs);
+  return p.prog;
+}
+
+static std::string cache_dir;
+// an empty cache_dir set by the caller disables the cache
+static bool cache_dir_set = false;
+
+void set_program_cache_dir(const char *dir) {
+  cache_dir = dir ? dir : "";
+  cache_dir_set = dir != nullptr;
+}
+
+static std::string default_cache_dir() {
+  if (const char *dir = getenv("EGL_MALI_SHADER_CACHE"))
+    return dir;
+  if (const char *dir = getenv("XDG_CACHE_HOME"))
+    return std::string(dir) + "/egl_mali";
+  if (const char *dir = getenv("HOME"))
+    return std::string(dir) + "/.cache/egl_mali";
+  return "";
+}
+
+static bool make_dirs(const std::string &path) {
+  for (size_t pos = 1; pos <= path.size(); pos++) {
+    if (pos != path.size() && path[pos] != '/')
+      continue;
+    std::string sub = path.substr(0, pos);
+    if (mkdir(sub.c_str(), 0755) != 0 && errno != EEXIST)
+      return false;
+  }
+  return true;
+}
+
+static uint64_t fnv1a(uint64_t h, const void *data, size_t len) {
+  auto *p = (const uint8_t *)data;
+  for (size_t i = 0; i < len; i++) {
+    h ^= p[i];
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+static uint64_t fnv1a(uint64_t h, const char *str) {
+  // the terminator separates the fields
+  return fnv1a(h, str ? str : "", str ? strlen(str) + 1 : 1);
+}
+
+/*
+ * Everything besides the sources that makes a binary stale: renderer, GL
+ * version (Mali puts the driver build there) and EGL version. Needs the GL
+ * thread, the key itself can be computed anywhere.
+ */
+static std::string driver_id() {
+  std::string id;
+  auto add = [&](const char *str) {
+    id += str ? str : "";
+    id += '\n';
+  };
+  add((const char *)glGetString(GL_VENDOR));
+  add((const char *)glGetString(GL_RENDERER));
+  add((const char *)glGetString(GL_VERSION));
+  EGLDisplay disp = eglGetCurrentDisplay();
+  if (disp != EGL_NO_DISPLAY) {
+    add(eglQueryString(disp, EGL_VENDOR));
+    add(eglQueryString(disp, EGL_VERSION));
+  }
+  return id;
+}
+
+static uint64_t program_key(const std::string &vert_src,
+                            const std::string &frag_src,
+                            const std::string &driver) {
+  uint64_t h = 0xcbf29ce484222325ull;
+  h = fnv1a(h, vert_src.c_str());
+  h = fnv1a(h, frag_src.c_str());
+  h = fnv1a(h, driver.c_str());
+  return h;
+}
+
+static const char cache_magic[8] = {'E', 'G', 'L', 'M', 'P', 'R', 'G', '1'};
+
+struct cache_header {
+  char magic[8];
+  uint64_t key;
+  uint32_t format;
+  uint32_t length;
+  // of the binary, catches truncated or corrupted files
+  uint64_t checksum;
+};
+
+static PFNGLGETPROGRAMBINARYOESPROC get_program_binary = nullptr;
+static PFNGLPROGRAMBINARYOESPROC program_binary = nullptr;
+static std::string driver;
+
+static bool init_program_binary() {
+  static std::mutex mutex;
+  static int state = -1;
+  std::lock_guard<std::mutex> lock(mutex);
+  if (state < 0) {
+    state = 0;
+    GLint formats = 0;
+    if (gl_has_extension("GL_KHR_parallel_shader_compile")) {
+      auto max_threads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)
+          eglGetProcAddress("glMaxShaderCompilerThreadsKHR");
+      if (max_threads)
+        max_threads(0xffffffff);
+    }
+    if (gl_has_extension("GL_OES_get_program_binary")) {
+      glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &formats);
+      get_program_binary = (PFNGLGETPROGRAMBINARYOESPROC)eglGetProcAddress(
+          "glGetProgramBinaryOES");
+      program_binary =
+          (PFNGLPROGRAMBINARYOESPROC)eglGetProcAddress("glProgramBinaryOES");
+    }
+    if (!cache_dir_set)
+      cache_dir = default_cache_dir();
+    driver = driver_id();
+    state = formats > 0 && get_program_binary && program_binary &&
+            !cache_dir.empty();
+    printf("Program binary cache: %s\n", state ? cache_dir.c_str() : "off");
+  }
+  return state == 1;
+}
+
+static std::string cache_path(uint64_t key) {
+  char name[32];
+  snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long)key);
+  return cache_dir + name;
+}
+
+struct cached_prog {
+  cache_header hdr;
+  std::vector<char> binary;
+};
+
+// file part of the cache lookup, safe to run on any thread
+static bool read_cached_prog(uint64_t key, cached_prog &out) {
+  std::ifstream in(cache_path(key), std::ios::binary);
+  if (!in)
+    return false;
+  auto &hdr = out.hdr;
+  if (!in.read((char *)&hdr, sizeof(hdr)) ||
+      memcmp(hdr.magic, cache_magic, sizeof(cache_magic)) != 0 ||
+      hdr.key != key || hdr.length == 0)
+    return false;
+  out.binary.resize(hdr.length);
+  return in.read(out.binary.data(), out.binary.size()) &&
+         fnv1a(0xcbf29ce484222325ull, out.binary.data(),
+               out.binary.size()) == hdr.checksum;
+}
+
+static GLuint load_cached_prog(const cached_prog &cached) {
+  GLuint prog = glCreateProgram();
+  program_binary(prog, cached.hdr.format, cached.binary.data(),
+                 cached.hdr.length);
+  GLint success = 0;
+  glGetProgramiv(prog, GL_LINK_STATUS, &success);
+  // the driver may reject binaries of another build, that is not an error
+  while (glGetError() != GL_NO_ERROR) {
+  }
+  if (!success) {
+    glDeleteProgram(prog);
+    return 0;
+  }
+  return prog;
+}
+
+static void store_cached_prog(uint64_t key, GLuint prog) {
+  GLint length = 0;
+  glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+  if (length <= 0 || !make_dirs(cache_dir))
+    return;
+  std::vector<char> binary(length);
+  cache_header hdr;
+  memcpy(hdr.magic, cache_magic, sizeof(cache_magic));
+  hdr.key = key;
+  GLenum format = 0;
+  GLsizei written = 0;
+  get_program_binary(prog, length, &written, &format, binary.data());
+  if (glGetError() != GL_NO_ERROR || written <= 0)
+    return;
+  hdr.format = format;
+  hdr.length = written;
+  hdr.checksum = fnv1a(0xcbf29ce484222325ull, binary.data(), written);
+
+  // write and rename so a concurrent start never sees a partial file,
+  // render workers may store the same program at once
+  auto path = cache_path(key);
+  auto tmp = path + "." + std::to_string(getpid()) + "." +
+             std::to_string(std::hash<std::thread::id>()(
+                 std::this_thread::get_id()));
+  {
+    std::ofstream out(tmp, std::ios::binary);
+    out.write((const char *)&hdr, sizeof(hdr));
+    out.write(binary.data(), written);
+    if (!out) {
+      unlink(tmp.c_str());
+      return;
+    }
+  }
+  if (rename(tmp.c_str(), path.c_str()) != 0)
+    unlink(tmp.c_str());
+}
+
+std::vector<GLuint> create_progs(const std::vector<prog_source> &sources) {
+  std::vector<GLuint> progs(sources.size(), 0);
+  std::vector<pending_prog> pending(sources.size());
+  std::vector<uint64_t> keys(sources.size(), 0);
+  bool cache = init_program_binary();
+
+  if (cache) {
+    // hashing and reading the cache files is the CPU heavy part of a warm
+    // start, spread it over the cores
+    std::vector<cached_prog> cached(sources.size());
+    std::vector<std::future<bool>> reads;
+    for (size_t i = 0; i < sources.size(); i++) {
+      reads.push_back(std::async(std::launch::async, [&, i] {
+        keys[i] = program_key(sources[i].vert, sources[i].frag, driver);
+        return read_cached_prog(keys[i], cached[i]);
+      }));
+    }
+    for (size_t i = 0; i < sources.size(); i++) {
+      if (reads[i].get())
+        progs[i] = load_cached_prog(cached[i]);
+    }
+  }
+  // issue every missing program before waiting on any of them
+  for (size_t i = 0; i < sources.size(); i++) {
+    if (progs[i] == 0)
+      pending[i] = start_compile(sources[i].vert, sources[i].frag);
+  }
+  for (size_t i = 0; i < sources.size(); i++) {
+    if (progs[i] != 0)
+      continue;
+    progs[i] = finish_compile(pending[i]);
+    if (cache)
+      store_cached_prog(keys[i], progs[i]);
+  }
+  return progs;
+}
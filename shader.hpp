@@ -0,0 +1,46 @@
+#pragma once
+#include "glad/gles2.h"
+#include <string>
+#include <vector>
+
+// attribute location of "pos" in every program
+#define ATTRIB_POS 0
+// of "color", the per-vertex color of the overlay quads
+#define ATTRIB_COLOR 1
+
+std::string read_file(const char *path);
+
+/*
+ * Inserts `defines` (e.g. "#define OUTPUT_Y\n") right after the #version
+ * line, used to build shader variants from one source.
+ */
+std::string inject_defines(const std::string &src, const char *defines);
+
+#ifndef GL_OES_get_program_binary
+#define GL_OES_get_program_binary 1
+#define GL_PROGRAM_BINARY_LENGTH_OES 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS_OES 0x87FE
+#define GL_PROGRAM_BINARY_FORMATS_OES 0x87FF
+#endif
+
+/*
+ * Linked programs are cached with GL_OES_get_program_binary in this
+ * directory. Defaults to $EGL_MALI_SHADER_CACHE, $XDG_CACHE_HOME/egl_mali
+ * or ~/.cache/egl_mali, an empty string disables the cache and nullptr
+ * restores the default. Has to be set before the first create_progs.
+ */
+void set_program_cache_dir(const char *dir);
+
+struct prog_source {
+  std::string vert, frag;
+};
+
+/*
+ * Builds several programs at once. A cached binary for the same sources,
+ * GPU and driver build is used when it loads, otherwise the sources are
+ * compiled and the result cached. Cache lookups run on worker threads and
+ * all missing programs are compiled and linked before any status is
+ * queried, so drivers with background compilation (or
+ * GL_KHR_parallel_shader_compile) build them in parallel.
+ */
+std::vector<GLuint> create_progs(const std::vector<prog_source> &sources);
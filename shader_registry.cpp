@@ -0,0 +1,158 @@
+#include "shader_registry.hpp"
+#include "resample_filter.hpp"
+#include "shader.hpp"
+#include "glad/egl.h"
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <stdlib.h>
+
+#define INCBIN_PREFIX shader_
+#define INCBIN_STYLE INCBIN_STYLE_SNAKE
+#include "incbin.h"
+
+// SHADER_DIR is set by CMake to the absolute source path
+INCTXT(simple_vert, SHADER_DIR "/simple.vert");
+INCTXT(simple_frag, SHADER_DIR "/simple.frag");
+INCTXT(overlay_vert, SHADER_DIR "/overlay.vert");
+INCTXT(overlay_frag, SHADER_DIR "/overlay.frag");
+
+struct embedded_shader {
+  const char *name;
+  const char *data;
+  const unsigned int *size;
+};
+
+static const embedded_shader embedded_shaders[] = {
+    {"simple.vert", shader_simple_vert_data, &shader_simple_vert_size},
+    {"simple.frag", shader_simple_frag_data, &shader_simple_frag_size},
+    {"overlay.vert", shader_overlay_vert_data, &shader_overlay_vert_size},
+    {"overlay.frag", shader_overlay_frag_data, &shader_overlay_frag_size},
+};
+
+const std::string &get_shader_source(const std::string &name) {
+  static std::mutex mutex;
+  static std::map<std::string, std::string> sources;
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = sources.find(name);
+  if (it != sources.end())
+    return it->second;
+
+  std::string src;
+  if (const char *dir = getenv("EGL_MALI_SHADER_DIR")) {
+    src = read_file((std::string(dir) + "/" + name).c_str());
+    if (src.empty())
+      printf("Shader %s not found in %s, using the embedded one\n",
+             name.c_str(), dir);
+  }
+  if (src.empty()) {
+    for (auto &shader : embedded_shaders) {
+      // INCTXT counts the terminator
+      if (name == shader.name)
+        src.assign(shader.data, *shader.size - 1);
+    }
+  }
+  if (src.empty())
+    printf("Unknown shader %s\n", name.c_str());
+  return sources[name] = src;
+}
+
+// tap varyings the driver allows next to v_uv, queried once
+static int max_filter_varyings() {
+  static const int count = [] {
+    GLint vectors = 0;
+    glGetIntegerv(GL_MAX_VARYING_VECTORS, &vectors);
+    // GLES2 guarantees 8
+    return std::max(vectors, 8) - 1;
+  }();
+  return count;
+}
+
+std::string variant_defines(const shader_variant &variant) {
+  std::string defines;
+  if (variant.input != shader_input::external)
+    defines += "#define INPUT_2D\n";
+  if (variant.input == shader_input::luma2d)
+    defines += "#define INPUT_LUMA\n";
+  resample_kernel kernel = find_kernel(variant.filter);
+  if (!kernel.taps.empty())
+    defines += generate_filter_defines(kernel, max_filter_varyings());
+  else
+    printf("Unknown filter %s, using bilinear\n", variant.filter.c_str());
+  if (variant.precision == shader_precision::highp)
+    defines += "#define PRECISION highp\n";
+  return defines + variant.defines;
+}
+
+/*
+ * Uniform values are program state, shared by every context of the share
+ * group. Render workers set them concurrently, so each context links its
+ * own programs (the binary cache keeps that cheap).
+ */
+typedef std::pair<EGLContext, std::string> program_key;
+static std::map<program_key, GLuint> programs;
+// guards the map only, contexts compile and link in parallel
+static std::mutex programs_mutex;
+
+static program_key variant_key(const shader_variant &variant) {
+  return {eglGetCurrentContext(),
+          variant.vert + '\n' + variant.frag + '\n' +
+              variant_defines(variant)};
+}
+
+void precompile_variants(const std::vector<shader_variant> &variants) {
+  std::vector<program_key> keys;
+  std::vector<prog_source> sources;
+  for (auto &variant : variants) {
+    auto key = variant_key(variant);
+    bool known;
+    {
+      std::lock_guard<std::mutex> lock(programs_mutex);
+      known = programs.count(key) != 0;
+    }
+    for (auto &k : keys)
+      known = known || k == key;
+    if (known)
+      continue;
+    auto defines = variant_defines(variant);
+    keys.push_back(key);
+    sources.push_back(
+        {inject_defines(get_shader_source(variant.vert), defines.c_str()),
+         inject_defines(get_shader_source(variant.frag), defines.c_str())});
+  }
+  if (sources.empty())
+    return;
+  auto progs = create_progs(sources);
+  std::lock_guard<std::mutex> lock(programs_mutex);
+  for (size_t i = 0; i < keys.size(); i++) {
+    // built by another call on this context in the meantime
+    if (!programs.emplace(keys[i], progs[i]).second)
+      glDeleteProgram(progs[i]);
+  }
+}
+
+GLuint get_variant_program(const shader_variant &variant) {
+  auto key = variant_key(variant);
+  {
+    std::lock_guard<std::mutex> lock(programs_mutex);
+    auto it = programs.find(key);
+    if (it != programs.end())
+      return it->second;
+  }
+  precompile_variants({variant});
+  std::lock_guard<std::mutex> lock(programs_mutex);
+  return programs[key];
+}
+
+void release_variant_programs() {
+  std::lock_guard<std::mutex> lock(programs_mutex);
+  EGLContext ctx = eglGetCurrentContext();
+  for (auto it = programs.begin(); it != programs.end();) {
+    if (it->first.first == ctx) {
+      glDeleteProgram(it->second);
+      it = programs.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
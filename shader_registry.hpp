@@ -0,0 +1,59 @@
+#pragma once
+
+#include "glad/gles2.h"
+#include <string>
+#include <vector>
+
+/*
+ * Shaders are embedded into the binary at build time, deployments don't
+ * need a shaders/ directory. Setting EGL_MALI_SHADER_DIR loads them from
+ * that directory instead, for editing shaders without a rebuild.
+ */
+const std::string &get_shader_source(const std::string &name);
+
+enum class shader_input {
+  // capture dmabuf imported as GL_TEXTURE_EXTERNAL_OES
+  external,
+  // regular GL_TEXTURE_2D, e.g. an intermediate render target
+  tex2d,
+  // GL_TEXTURE_2D holding luma in R, a luma only intermediate
+  luma2d,
+};
+
+enum class shader_precision {
+  mediump,
+  highp,
+};
+
+/*
+ * One program built from the embedded sources. The fields are turned into
+ * defines injected after #version: INPUT_2D (and INPUT_LUMA), the
+ * generated resampling
+ * filter of the kernel named `filter` (see resample_filter.hpp) and
+ * PRECISION. `defines` carries the output packing and preprocessing of
+ * the pass.
+ */
+struct shader_variant {
+  std::string vert = "simple.vert";
+  std::string frag = "simple.frag";
+  std::string defines;
+  shader_input input = shader_input::external;
+  std::string filter = "sharpen";
+  shader_precision precision = shader_precision::mediump;
+};
+
+std::string variant_defines(const shader_variant &variant);
+
+/*
+ * Builds all variants a configuration needs in one go, see create_progs.
+ * Programs belong to the current context and are not shared with the
+ * other contexts of the share group, since their uniforms are set per
+ * draw. Variants that were built before are not rebuilt.
+ */
+void precompile_variants(const std::vector<shader_variant> &variants);
+
+// program of `variant` for the current context, built on first use
+GLuint get_variant_program(const shader_variant &variant);
+
+// deletes the programs of the current context, before it is released
+void release_variant_programs();
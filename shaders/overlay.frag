@@ -0,0 +1,9 @@
+#version 100
+precision mediump float;
+varying vec2 v_uv;
+varying vec4 v_color;
+// glyph coverage in luminance, boxes sample the solid last cell
+uniform sampler2D s_glyphs;
+void main(){
+    gl_FragColor = vec4(v_color.rgb, v_color.a * texture2D(s_glyphs, v_uv).r);
+}
@@ -0,0 +1,12 @@
+#version 100
+// boxes and text of overlay.hpp, one quad per glyph or box edge
+// clip space position in xy, glyph atlas coordinates in zw
+attribute vec4 pos;
+attribute vec4 color;
+varying vec2 v_uv;
+varying vec4 v_color;
+void main(){
+  gl_Position=vec4(pos.xy,0,1);
+  v_uv = pos.zw;
+  v_color = color;
+}
@@ -1,26 +1,183 @@
 #version 100
+// variants are selected by defines injected after #version, see
+// shader_registry.hpp
+#ifndef INPUT_2D
 #extension GL_OES_EGL_image_external : require
- 
+#endif
 
-precision mediump float;
-varying vec2 v_uv; 
-// uniform sampler2D s_texture2D;
+#ifndef PRECISION
+#define PRECISION mediump
+#endif
+#ifndef FILTER_DECL
+#define FILTER_DECL
+#define FILTER_FETCH_TAPS texture2D(s_texture2D, v_uv).xyz
+#define FILTER_FETCH(uv) texture2D(s_texture2D, uv).xyz
+#endif
+
+precision PRECISION float;
+varying vec2 v_uv;
+#ifdef INPUT_2D
+uniform sampler2D s_texture2D;
+#else
 uniform samplerExternalOES s_texture2D;
-#define INPUT_RES vec2(1920.0,1080.0)
+#endif
+// 1 / input size, the filter tap spacing
+uniform vec2 u_texel;
+FILTER_DECL
+
+// luma intermediates hold luma in R, expanded to gray
+#ifdef INPUT_LUMA
+#define INPUT_SWIZZLE xxx
+#else
+#define INPUT_SWIZZLE xyz
+#endif
+
+// filtered input around an arbitrary position, the taps are computed here
+vec3 sample_input(vec2 uv){
+    return (FILTER_FETCH(uv)).INPUT_SWIZZLE;
+}
+
+// filtered input at v_uv from the tap varyings of the vertex shader
+vec3 sample_taps(){
+    return (FILTER_FETCH_TAPS).INPUT_SWIZZLE;
+}
+
+#ifdef MASK
+// privacy masks, see mask.hpp. u_mask_map maps gl_FragCoord to input
+// coordinates, u_mask is the block size or blur radius in target pixels
+uniform vec4 u_mask_map;
+uniform float u_mask;
+
+vec3 sample_mask(){
+#ifdef MASK_BLUR
+    vec2 uv = gl_FragCoord.xy * u_mask_map.xy + u_mask_map.zw;
+    vec2 spacing = u_mask / 1.5 * u_mask_map.xy;
+    vec3 sum = vec3(0.0);
+    for (int y = 0; y < 4; y++) {
+        for (int x = 0; x < 4; x++)
+            sum += sample_input(uv + (vec2(x, y) - 1.5) * spacing);
+    }
+    return sum / 16.0;
+#else
+    // 4 bilinear taps around the block center, every pixel of the block
+    // gets the same color
+    vec2 center = (floor(gl_FragCoord.xy / u_mask) + 0.5) * u_mask;
+    vec2 uv = center * u_mask_map.xy + u_mask_map.zw;
+    vec2 d = 0.25 * u_mask * u_mask_map.xy;
+    return 0.25 * (sample_input(uv - d) + sample_input(uv + d) +
+                   sample_input(uv + vec2(d.x, -d.y)) +
+                   sample_input(uv + vec2(-d.x, d.y)));
+#endif
+}
+#endif
+
+float luma(vec3 col){
+    // BT.709 full range, the inverse of the capture import
+    return dot(col, vec3(0.2126, 0.7152, 0.0722));
+}
+
+#if defined(OUTPUT_QUANT)
+// model preprocessing folded into q = x * a + b, see output_norm
+uniform vec3 u_quant_a;
+uniform vec3 u_quant_b;
+uniform vec2 u_quant_range;
+uniform float u_quant_signed;
+
+vec3 preprocess(vec3 col){
+    vec3 q = clamp(floor(col * u_quant_a + u_quant_b + 0.5),
+                   u_quant_range.x, u_quant_range.y);
+    // int8 is stored as two's complement bytes
+    q += u_quant_signed * 256.0 * step(q, vec3(-0.5));
+    return q / 255.0;
+}
+
+// single channel outputs quantize the weighted scalar, with the
+// parameters of the lanes weighted the same way
+float preprocess_channel(float x, vec3 w){
+    float q = clamp(floor(x * dot(u_quant_a, w) + dot(u_quant_b, w) + 0.5),
+                    u_quant_range.x, u_quant_range.y);
+    q += u_quant_signed * 256.0 * step(q, -0.5);
+    return q / 255.0;
+}
+#elif defined(OUTPUT_NORM)
+// (x - mean) / std folded into x * a + b, written to half float targets
+uniform vec3 u_quant_a;
+uniform vec3 u_quant_b;
+
+vec3 preprocess(vec3 col){
+    return col * u_quant_a + u_quant_b;
+}
+
+float preprocess_channel(float x, vec3 w){
+    return x * dot(u_quant_a, w) + dot(u_quant_b, w);
+}
+#else
+vec3 preprocess(vec3 col){
+    return col;
+}
+
+float preprocess_channel(float x, vec3 w){
+    return x;
+}
+#endif
+
+#if defined(OUTPUT_PACK_RGB) || defined(OUTPUT_PACK_R)
+// packed outputs: every RGBA8888 fragment holds 4 bytes of the real
+// RGB888/R8 row, so the horizontal mapping is done per output pixel here.
+// x,y: viewport x and width of the content in output pixels
+uniform vec4 u_pack;
+uniform vec4 u_crop;
+uniform vec4 u_pad;
+// weights of the channel a packed single channel output holds
+uniform vec3 u_channel;
+
+vec3 sample_px(float px){
+    if (px < u_pack.x || px >= u_pack.x + u_pack.y)
+        return u_pad.rgb;
+    float u = u_crop.x + (px + 0.5 - u_pack.x) / u_pack.y * u_crop.z;
+    return sample_input(vec2(u, v_uv.y));
+}
+
+// the weights apply to the unquantized color
+float sample_channel(float px){
+    return preprocess_channel(dot(sample_px(px), u_channel), u_channel);
+}
+#endif
 
 void main(){
-    // gl_FragColor = texture2D( s_texture, v_uv);
-    vec3 col = vec3(0.0);
-    col += 0.37487566 * texture2D(s_texture2D, v_uv + vec2(-0.75777156,-0.75777156)/INPUT_RES).xyz;
-    col += 0.37487566 * texture2D(s_texture2D, v_uv + vec2(0.75777156,-0.75777156)/INPUT_RES).xyz;
-    col += 0.37487566 * texture2D(s_texture2D, v_uv + vec2(0.75777156,0.75777156)/INPUT_RES).xyz;
-    col += 0.37487566 * texture2D(s_texture2D, v_uv + vec2(-0.75777156,0.75777156)/INPUT_RES).xyz;
-    
-    col += -0.12487566 * texture2D(s_texture2D, v_uv + vec2(-2.90709914,0.0)/INPUT_RES).xyz;
-    col += -0.12487566 * texture2D(s_texture2D, v_uv + vec2(2.90709914,0.0)/INPUT_RES).xyz;
-    col += -0.12487566 * texture2D(s_texture2D, v_uv + vec2(0.0,-2.90709914)/INPUT_RES).xyz;
-    col += -0.12487566 * texture2D(s_texture2D, v_uv + vec2(0.0,2.90709914)/INPUT_RES).xyz;
-
-    gl_FragColor = vec4(col,1);
+#if defined(OUTPUT_PACK_RGB)
+    // 4 bytes starting at byte 4X cover parts of two RGB pixels, the split
+    // repeats every 3 fragments
+    float x = floor(gl_FragCoord.x);
+    float q = floor((x + 0.5) / 3.0);
+    float phase = x - 3.0 * q;
+    float px = 4.0 * q + phase;
+    vec3 a = preprocess(sample_px(px));
+    vec3 b = preprocess(sample_px(px + 1.0));
+    if (phase < 0.5)
+        gl_FragColor = vec4(a.rgb, b.r);
+    else if (phase < 1.5)
+        gl_FragColor = vec4(a.gb, b.rg);
+    else
+        gl_FragColor = vec4(a.b, b.rgb);
+#elif defined(OUTPUT_PACK_R)
+    float px = 4.0 * floor(gl_FragCoord.x);
+    gl_FragColor = vec4(sample_channel(px), sample_channel(px + 1.0),
+                        sample_channel(px + 2.0), sample_channel(px + 3.0));
+#else
+#ifdef MASK
+    vec3 col = sample_mask();
+#else
+    vec3 col = sample_taps();
+#endif
+#if defined(OUTPUT_Y)
+    gl_FragColor = vec4(luma(col), 0.0, 0.0, 1.0);
+#elif defined(OUTPUT_UV)
+    float y = luma(col);
+    gl_FragColor = vec4((col.b - y) / 1.8556 + 0.5, (col.r - y) / 1.5748 + 0.5, 0.0, 1.0);
+#else
+    gl_FragColor = vec4(preprocess(col),1);
+#endif
+#endif
   // gl_FragColor=vec4(1,1,1,1);
 }
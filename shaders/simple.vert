@@ -1,7 +1,38 @@
 #version 100
+// FILTER_* come from generate_filter_defines, plain bilinear without them
+#ifndef PRECISION
+#define PRECISION mediump
+#endif
+#ifndef FILTER_DECL
+#define FILTER_DECL
+#define FILTER_VERT
+#endif
+#ifdef VERTEX_UV
+// batched quads: clip space position in xy, input coordinates in zw
+attribute vec4 pos;
+#else
 attribute vec2 pos;
+#endif
 varying vec2 v_uv;
+// uniforms shared with the fragment shader need the same precision there
+// x,y,w,h of the sampled input region
+uniform PRECISION vec4 u_crop;
+// 1 / input size, the filter tap spacing
+uniform PRECISION vec2 u_texel;
+FILTER_DECL
 void main(){
+#ifdef VERTEX_UV
+  gl_Position=vec4(pos.xy,0,1);
+  v_uv = pos.zw;
+#elif defined(MASK)
+  // mask geometry, the fragment shader maps gl_FragCoord to the input
   gl_Position=vec4(pos,0,1);
-  v_uv = pos*0.5+0.5;
+  v_uv = vec2(0.0);
+#else
+  gl_Position=vec4(pos,0,1);
+  v_uv = u_crop.xy + (pos*0.5+0.5)*u_crop.zw;
+#endif
+  // tap coordinates are varyings, Mali-400 fetches them without a
+  // dependent texture read
+  FILTER_VERT
 }
@@ -0,0 +1,65 @@
+#include "tiles.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdio.h>
+
+// start of the tiles along one axis, evenly spread, the last one flush
+// with the end
+static std::vector<int> tile_starts(int size, int tile, float overlap,
+                                    int &count) {
+  if (tile >= size) {
+    // a single tile centered on the input, the rest is letterboxed away
+    count = 1;
+    return {(size - tile) / 2};
+  }
+  if (count <= 0) {
+    float stride = tile * (1 - std::min(std::max(overlap, 0.0f), 0.9f));
+    count = (int)std::ceil((size - tile) / stride) + 1;
+  }
+  std::vector<int> starts;
+  for (int i = 0; i < count; i++)
+    starts.push_back(count == 1 ? (size - tile) / 2
+                                : std::lround((float)(size - tile) * i /
+                                              (count - 1)));
+  return starts;
+}
+
+tile_plan plan_tiles(const tile_spec &spec, int in_w, int in_h) {
+  tile_plan plan;
+  float scale = spec.scale > 0 ? spec.scale : 1;
+  int tile_w = std::lround(spec.tile.w / scale);
+  int tile_h = std::lround(spec.tile.h / scale);
+  plan.cols = spec.cols;
+  plan.rows = spec.rows;
+  auto xs = tile_starts(in_w, tile_w, spec.overlap, plan.cols);
+  auto ys = tile_starts(in_h, tile_h, spec.overlap, plan.rows);
+  for (int r = 0; r < plan.rows; r++) {
+    for (int c = 0; c < plan.cols; c++) {
+      tile_rect rect = {c, r, xs[c], ys[r], tile_w, tile_h};
+      plan.tiles.push_back(rect);
+      output_spec tile = spec.tile;
+      // same aspect as the tile, a tile larger than the input is clamped
+      // to it and letterboxed
+      int x = std::max(rect.x, 0), y = std::max(rect.y, 0);
+      int w = std::min(rect.w, in_w), h = std::min(rect.h, in_h);
+      tile.crop = {(float)x / in_w, (float)y / in_h, (float)w / in_w,
+                   (float)h / in_h};
+      tile.fit = w == rect.w && h == rect.h ? output_fit::stretch
+                                            : output_fit::letterbox;
+      plan.specs.push_back(tile);
+    }
+  }
+  if (spec.global_view) {
+    output_spec global = spec.tile;
+    global.crop = {};
+    global.fit = output_fit::letterbox;
+    // the whole frame is reduced a lot, plain filtering aliases
+    if (global.downscale == output_downscale::none)
+      global.downscale = output_downscale::area;
+    plan.specs.push_back(global);
+  }
+  printf("Tiles: %dx%d of %dx%d input pixels at scale %.2f%s\n", plan.cols,
+         plan.rows, tile_w, tile_h, scale,
+         spec.global_view ? " plus a global view" : "");
+  return plan;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "output_spec.hpp"
+#include <vector>
+
+/*
+ * SAHI style tiling: the capture is cut into a grid of overlapping
+ * model-sized tiles so small objects keep their resolution, optionally
+ * with a downscaled view of the whole frame for the large ones. Tiles are
+ * plain output specs with a crop, they are rendered from the capture in
+ * the batch of their stream and every frame carries its tile-to-sensor
+ * transform.
+ */
+struct tile_spec {
+  // size, format and preprocessing of every tile
+  output_spec tile;
+  // input pixels per tile pixel is 1 / scale: 1 cuts native resolution
+  // tiles, 0.5 tiles of twice the size at half resolution, which want
+  // tile.downscale set
+  float scale = 1;
+  // minimum overlap of neighbouring tiles as a fraction of the tile
+  float overlap = 0.2f;
+  // grid size, 0 picks the fewest tiles that keep the overlap
+  int cols = 0, rows = 0;
+  // adds a letterboxed view of the whole frame after the tiles
+  bool global_view = true;
+};
+
+// region of a tile in input pixels
+struct tile_rect {
+  int col, row;
+  int x, y, w, h;
+};
+
+struct tile_plan {
+  int cols = 0, rows = 0;
+  std::vector<tile_rect> tiles;
+  // tiles in row-major order, then the global view
+  std::vector<output_spec> specs;
+};
+
+tile_plan plan_tiles(const tile_spec &spec, int in_w, int in_h);
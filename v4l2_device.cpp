@@ -1,5 +1,7 @@
 #include "v4l2_device.hpp"
 #include "common.h"
+#include "fp16_output.hpp"
+#include "gl_state.hpp"
 #include <cassert>
 #include <drm/drm_fourcc.h>
 #include <errno.h>
@@ -163,6 +165,38 @@ err_cleanup:
   close(fd);
   return {};
 }
+
+static EGLImageKHR create_nv12_drm(int w, int h, int fd, EGLDisplay disp) {
+  EGLint attributes[] = {
+      EGL_WIDTH,
+      w,
+      EGL_HEIGHT,
+      h,
+      EGL_LINUX_DRM_FOURCC_EXT,
+      DRM_FORMAT_NV12,
+      EGL_DMA_BUF_PLANE0_FD_EXT,
+      (EGLint)fd,
+      EGL_DMA_BUF_PLANE0_OFFSET_EXT,
+      0,
+      EGL_DMA_BUF_PLANE0_PITCH_EXT,
+      w,
+      EGL_DMA_BUF_PLANE1_FD_EXT,
+      (EGLint)fd,
+      EGL_DMA_BUF_PLANE1_OFFSET_EXT,
+      w * h,
+      EGL_DMA_BUF_PLANE1_PITCH_EXT,
+      w,
+      EGL_YUV_COLOR_SPACE_HINT_EXT,
+      EGL_ITU_REC709_EXT,
+      EGL_SAMPLE_RANGE_HINT_EXT,
+      EGL_YUV_FULL_RANGE_EXT,
+      EGL_NONE,
+  };
+  EGLImageKHR eglImage = eglCreateImageKHR(
+      disp, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, nullptr, attributes);
+  return eglImage;
+}
+
 v4l2_dma_device_info init_dma(const v4l2_device_info &dev, int num_bufs,
                               EGLDisplay disp, EGLContext ctx) {
   v4l2_dma_device_info out;
@@ -236,33 +270,8 @@ v4l2_dma_device_info init_dma(const v4l2_device_info &dev, int num_bufs,
   }
   glGenTextures(num_bufs, tex.data());
   for (int i = 0; i < num_bufs; i++) {
-    EGLint attributes[] = {
-        EGL_WIDTH,
-        (EGLint)dev.fmt.fmt.pix_mp.width,
-        EGL_HEIGHT,
-        (EGLint)dev.fmt.fmt.pix_mp.height,
-        EGL_LINUX_DRM_FOURCC_EXT,
-        DRM_FORMAT_NV12,
-        EGL_DMA_BUF_PLANE0_FD_EXT,
-        out.dma_bufs[i],
-        EGL_DMA_BUF_PLANE0_OFFSET_EXT,
-        0,
-        EGL_DMA_BUF_PLANE0_PITCH_EXT,
-        w,
-        EGL_DMA_BUF_PLANE1_FD_EXT,
-        out.dma_bufs[i],
-        EGL_DMA_BUF_PLANE1_OFFSET_EXT,
-        w * h,
-        EGL_DMA_BUF_PLANE1_PITCH_EXT,
-        w / 2,
-        EGL_YUV_COLOR_SPACE_HINT_EXT,
-        EGL_ITU_REC709_EXT,
-        EGL_SAMPLE_RANGE_HINT_EXT,
-        EGL_YUV_FULL_RANGE_EXT,
-        EGL_NONE,
-    };
-    EGLImageKHR eglImage = eglCreateImageKHR(
-        disp, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, nullptr, attributes);
+    // the interleaved UV plane has the same pitch as the Y plane
+    EGLImageKHR eglImage = create_nv12_drm(w, h, out.dma_bufs[i], disp);
 
     if (eglImage == 0) {
       printf("Failed EGL create image %i \n", eglGetError());
@@ -294,38 +303,20 @@ err_cleanup:
   return {};
 }
 
-EGLImageKHR create_nv12_drm(int w, int h, int fd, EGLDisplay disp) {
-  EGLint attributes[] = {
-      EGL_WIDTH,
-      w,
-      EGL_HEIGHT,
-      h,
-      EGL_LINUX_DRM_FOURCC_EXT,
-      DRM_FORMAT_NV12,
-      EGL_DMA_BUF_PLANE0_FD_EXT,
-      (EGLint)fd,
-      EGL_DMA_BUF_PLANE0_OFFSET_EXT,
-      0,
-      EGL_DMA_BUF_PLANE0_PITCH_EXT,
-      w,
-      EGL_DMA_BUF_PLANE1_FD_EXT,
-      (EGLint)fd,
-      EGL_DMA_BUF_PLANE1_OFFSET_EXT,
-      w * h,
-      EGL_DMA_BUF_PLANE1_PITCH_EXT,
-      w / 2,
-
-      EGL_YUV_COLOR_SPACE_HINT_EXT,
-      EGL_ITU_REC709_EXT,
-      EGL_SAMPLE_RANGE_HINT_EXT,
-      EGL_YUV_FULL_RANGE_EXT,
-      EGL_NONE,
-  };
-  EGLImageKHR eglImage = eglCreateImageKHR(
-      disp, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, nullptr, attributes);
-  return eglImage;
+std::vector<GLuint> import_capture_textures(const v4l2_dma_device_info &dma) {
+  std::vector<GLuint> tex(dma.egl_imgs.size());
+  glGenTextures(tex.size(), tex.data());
+  for (size_t i = 0; i < tex.size(); i++) {
+    GL_CHECK(glBindTexture(GL_TEXTURE_EXTERNAL_OES, tex[i]));
+    GL_CHECK(glEGLImageTargetTexture2DOES(GL_TEXTURE_EXTERNAL_OES,
+                                          dma.egl_imgs[i].img));
+  }
+  gl_state_invalidate();
+  return tex;
 }
-EGLImageKHR create_rg88_drm(int w, int h, int fd, EGLDisplay disp) {
+
+EGLImageKHR create_rg88_drm(int w, int h, int fd, EGLDisplay disp,
+                            int offset) {
   EGLint attributes[] = {
       EGL_WIDTH,
       w,
@@ -336,7 +327,7 @@ EGLImageKHR create_rg88_drm(int w, int h, int fd, EGLDisplay disp) {
       EGL_DMA_BUF_PLANE0_FD_EXT,
       (EGLint)fd,
       EGL_DMA_BUF_PLANE0_OFFSET_EXT,
-      0,
+      offset,
       EGL_DMA_BUF_PLANE0_PITCH_EXT,
       w * 2,
       EGL_NONE,
@@ -346,60 +337,69 @@ EGLImageKHR create_rg88_drm(int w, int h, int fd, EGLDisplay disp) {
   return eglImage;
 }
 
-EGLImageKHR create_rgb888_drm(int w, int h, int fd, EGLDisplay disp) {
+/*
+ * `fourcc` is DRM_FORMAT_RGBA8888 for RGBA outputs or DRM_FORMAT_ABGR8888
+ * (R, G, B, A bytes in memory, the order of gl_FragColor) for the packed
+ * aliases, which have to put every lane at its byte.
+ */
+EGLImageKHR create_rgb8888_drm(int w, int h, int fd, EGLDisplay disp,
+                               int offset, int fourcc) {
   EGLint attributes[] = {
       EGL_WIDTH,
       w,
       EGL_HEIGHT,
       h,
       EGL_LINUX_DRM_FOURCC_EXT,
-      DRM_FORMAT_RGB888,
+      fourcc,
       EGL_DMA_BUF_PLANE0_FD_EXT,
       (EGLint)fd,
       EGL_DMA_BUF_PLANE0_OFFSET_EXT,
-      0,
+      offset,
       EGL_DMA_BUF_PLANE0_PITCH_EXT,
-      w * 3,
+      w * 4,
       EGL_NONE,
   };
   EGLImageKHR eglImage = eglCreateImageKHR(
       disp, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, nullptr, attributes);
   return eglImage;
 }
-EGLImageKHR create_rgb8888_drm(int w, int h, int fd, EGLDisplay disp) {
+EGLImageKHR create_r8_drm(int w, int h, int fd, EGLDisplay disp,
+                          int offset) {
   EGLint attributes[] = {
       EGL_WIDTH,
       w,
       EGL_HEIGHT,
       h,
       EGL_LINUX_DRM_FOURCC_EXT,
-      DRM_FORMAT_RGBA8888,
+      DRM_FORMAT_R8,
       EGL_DMA_BUF_PLANE0_FD_EXT,
       (EGLint)fd,
       EGL_DMA_BUF_PLANE0_OFFSET_EXT,
-      0,
+      offset,
       EGL_DMA_BUF_PLANE0_PITCH_EXT,
-      w * 4,
+      w,
       EGL_NONE,
   };
   EGLImageKHR eglImage = eglCreateImageKHR(
       disp, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, nullptr, attributes);
   return eglImage;
 }
-EGLImageKHR create_r8_drm(int w, int h, int fd, EGLDisplay disp) {
+
+EGLImageKHR create_abgr16f_drm(int w, int h, int fd, EGLDisplay disp,
+                               int offset) {
   EGLint attributes[] = {
       EGL_WIDTH,
       w,
       EGL_HEIGHT,
       h,
       EGL_LINUX_DRM_FOURCC_EXT,
-      DRM_FORMAT_R8,
+      DRM_FORMAT_ABGR16161616F,
       EGL_DMA_BUF_PLANE0_FD_EXT,
       (EGLint)fd,
       EGL_DMA_BUF_PLANE0_OFFSET_EXT,
-      0,
+      offset,
       EGL_DMA_BUF_PLANE0_PITCH_EXT,
-      w,
+      w * 8,
       EGL_NONE,
   };
   EGLImageKHR eglImage = eglCreateImageKHR(
@@ -407,6 +407,76 @@ EGLImageKHR create_r8_drm(int w, int h, int fd, EGLDisplay disp) {
   return eglImage;
 }
 
+static bool init_render_target(EGLImage img, GLuint &rb, GLuint &fb) {
+#if 0
+
+  glActiveTexture(GL_TEXTURE0);
+  GL_CHECK(glGenTextures(1, &rb));
+  GL_CHECK(glBindTexture(GL_TEXTURE_2D, rb));
+  GL_CHECK(glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, img));
+  GL_CHECK(glGenFramebuffers(1, &fb));
+  GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, fb));
+  GL_CHECK(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                  GL_TEXTURE_2D, rb, 0));
+#else
+  if (!GL_VERIFY(glGenRenderbuffers(1, &rb))) {
+    return false;
+  }
+  if (!GL_VERIFY(glBindRenderbuffer(GL_RENDERBUFFER, rb))) {
+    return false;
+  }
+  if (!GL_VERIFY(glEGLImageTargetRenderbufferStorageOES(GL_RENDERBUFFER, img))) {
+    return false;
+  }
+  GL_CHECK(glGenFramebuffers(1, &fb));
+  GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, fb));
+  if (!GL_VERIFY(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                           GL_RENDERBUFFER, rb))) {
+    return false;
+  }
+
+#endif
+  return true;
+}
+
+/*
+ * Render targets of formats GLES2 can't render into with one draw, empty if
+ * the format is renderable as is.
+ */
+static std::vector<egl_dma_target>
+create_frame_planes(int w, int h, int format, int fd, EGLDisplay disp) {
+  switch (format) {
+  case DRM_FORMAT_NV12:
+    // no rendering into YUV images, the Y and the interleaved UV plane are
+    // rendered separately through R8/RG88 aliases of the same dmabuf
+    return {
+        {create_r8_drm(w, h, fd, disp, 0), 0, 0, w, h},
+        {create_rg88_drm(w / 2, h / 2, fd, disp, w * h), 0, 0, w / 2, h / 2},
+    };
+  case DRM_FORMAT_RGB888:
+    // 3 and 1 byte formats go through an ABGR8888 alias of the packed rows,
+    // every fragment writes 4 bytes of the real layout in lane order
+    return {{create_rgb8888_drm(w * 3 / 4, h, fd, disp, 0,
+                                DRM_FORMAT_ABGR8888),
+             0, 0, w * 3 / 4, h}};
+  case DRM_FORMAT_R8:
+    return {{create_rgb8888_drm(w / 4, h, fd, disp, 0, DRM_FORMAT_ABGR8888),
+             0, 0, w / 4, h}};
+  case FORMAT_RGB_CHW: {
+    // one packed R8 plane per channel, back to back
+    std::vector<egl_dma_target> planes;
+    for (int c = 0; c < 3; c++) {
+      planes.push_back(
+          {create_rgb8888_drm(w / 4, h, fd, disp, c * w * h,
+                              DRM_FORMAT_ABGR8888),
+           0, 0, w / 4, h});
+    }
+    return planes;
+  }
+  }
+  return {};
+}
+
 std::vector<egl_dma_frame> create_egl_frame(const v4l2_device_info &dev,
                                             const v4l2_dma_device_info &dma,
                                             EGLDisplay disp, int num_frames,
@@ -431,10 +501,27 @@ std::vector<egl_dma_frame> create_egl_frame(const v4l2_device_info &dev,
   case DRM_FORMAT_RGBA8888:
     size_img = w * h * 4;
     break;
+  case FORMAT_RGB_CHW:
+    size_img = w * h * 3;
+    break;
+  case DRM_FORMAT_ABGR16161616F:
+    size_img = w * h * 8;
+    break;
   default:
     printf("unsupported format");
     return {};
   }
+  if ((format == DRM_FORMAT_RGB888 || format == DRM_FORMAT_R8 ||
+       format == FORMAT_RGB_CHW) &&
+      w % 4 != 0) {
+    printf("packed outputs need a width that is a multiple of 4\n");
+    return {};
+  }
+  // the chroma plane is subsampled 2x2
+  if (format == DRM_FORMAT_NV12 && (w % 2 != 0 || h % 2 != 0)) {
+    printf("NV12 outputs need an even width and height\n");
+    return {};
+  }
 
   for (int i = 0; i < num_frames; i++) {
     egl_dma_frame frame = {};
@@ -448,21 +535,57 @@ std::vector<egl_dma_frame> create_egl_frame(const v4l2_device_info &dev,
       goto err_cleanup;
     }
 
+    frame.planes = create_frame_planes(w, h, format, frame.fd, disp);
+    if (!frame.planes.empty()) {
+      for (auto &plane : frame.planes) {
+        if (plane.img == 0) {
+          printf("Failed EGL create image %i \n", eglGetError());
+          goto err_cleanup;
+        }
+        if (!init_render_target(plane.img, plane.rb, plane.fb)) {
+          goto err_cleanup;
+        }
+      }
+      frame.fb = frame.planes[0].fb;
+      out.push_back(frame);
+      continue;
+    }
+
+    if (format == DRM_FORMAT_ABGR16161616F &&
+        get_fp16_mode() != fp16_mode::dmabuf) {
+      // rendered offscreen, read_back_fp16 fills the dmabuf
+      bool half = get_fp16_mode() == fp16_mode::readback;
+      glGenTextures(1, &frame.tex);
+      glBindTexture(GL_TEXTURE_2D, frame.tex);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA,
+                   half ? GL_HALF_FLOAT_OES : GL_UNSIGNED_BYTE, nullptr);
+      GL_CHECK(glGenFramebuffers(1, &frame.fb));
+      GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, frame.fb));
+      if (!GL_VERIFY(glFramebufferTexture2D(GL_FRAMEBUFFER,
+                                            GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                                            frame.tex, 0))) {
+        goto err_cleanup;
+      }
+      frame.map = mmap(0, size_img, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       frame.fd, 0);
+      if (frame.map == MAP_FAILED) {
+        printf("Failed to map frame: %s\n", strerror(errno));
+        goto err_cleanup;
+      }
+      out.push_back(frame);
+      continue;
+    }
+
     switch (format) {
-    case DRM_FORMAT_NV12:
-      frame.img = create_nv12_drm(w, h, frame.fd, disp);
+    case DRM_FORMAT_ABGR16161616F:
+      frame.img = create_abgr16f_drm(w, h, frame.fd, disp, 0);
       break;
     case DRM_FORMAT_RG88:
-      frame.img = create_rg88_drm(w, h, frame.fd, disp);
-      break;
-    case DRM_FORMAT_RGB888:
-      frame.img = create_rgb888_drm(w, h, frame.fd, disp);
-      break;
-    case DRM_FORMAT_R8:
-      frame.img = create_r8_drm(w, h, frame.fd, disp);
+      frame.img = create_rg88_drm(w, h, frame.fd, disp, 0);
       break;
     case DRM_FORMAT_RGBA8888:
-      frame.img = create_rgb8888_drm(w, h, frame.fd, disp);
+      frame.img =
+          create_rgb8888_drm(w, h, frame.fd, disp, 0, DRM_FORMAT_RGBA8888);
       break;
     default:
       goto err_cleanup;
@@ -471,36 +594,9 @@ std::vector<egl_dma_frame> create_egl_frame(const v4l2_device_info &dev,
       printf("Failed EGL create image %i \n", eglGetError());
       goto err_cleanup;
     }
-#if 0
-
-    glActiveTexture(GL_TEXTURE0);
-    GL_CHECK(glGenTextures(1, &frame.tex));
-    GL_CHECK(glBindTexture(GL_TEXTURE_2D, frame.tex));
-    GL_CHECK(glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, frame.img));
-    GL_CHECK(glGenFramebuffers(1, &frame.fb));
-    GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, frame.fb));
-    GL_CHECK(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-                                    GL_TEXTURE_2D, frame.tex, 0));
-#else
-    if (!GL_CHECK(glGenRenderbuffers(1, &frame.tex))) {
+    if (!init_render_target(frame.img, frame.tex, frame.fb)) {
       goto err_cleanup;
     }
-    if (!GL_CHECK(glBindRenderbuffer(GL_RENDERBUFFER, frame.tex))) {
-      goto err_cleanup;
-    }
-    if (!GL_CHECK(glEGLImageTargetRenderbufferStorageOES(GL_RENDERBUFFER,
-                                                         frame.img))) {
-      goto err_cleanup;
-    }
-    GL_CHECK(glGenFramebuffers(1, &frame.fb));
-    GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, frame.fb));
-    if (!GL_CHECK(glFramebufferRenderbuffer(GL_FRAMEBUFFER,
-                                            GL_COLOR_ATTACHMENT0,
-                                            GL_RENDERBUFFER, frame.tex))) {
-      goto err_cleanup;
-    }
-
-#endif
     out.push_back(frame);
   }
   return out;
@@ -17,6 +17,7 @@
 #include <sys/types.h>
 
 #include "glad/egl.h"
+#include "egl_sync.hpp"
 #include "glad/gles2.h"
 #include <unistd.h>
 #include <vector>
@@ -40,8 +41,49 @@ struct v4l2_dma_device_info {
   int dma_heap_fd = -1;
 };
 
+int dmabuf_heap_alloc(int heap_fd, const char *name, size_t size);
+int dmabuf_sync_start(int buf_fd);
+int dmabuf_sync_stop(int buf_fd);
+
 v4l2_dma_device_info init_dma(const v4l2_device_info &dev, int num_bufs,
                               EGLDisplay disp, EGLContext ctx);
+/*
+ * The capture EGLImages are not tied to a context, every render worker
+ * imports them into its own external textures, indexed like egl_imgs.
+ */
+std::vector<GLuint> import_capture_textures(const v4l2_dma_device_info &dma);
+
+/*
+ * Maps output pixel coordinates back to sensor pixel coordinates:
+ * sensor = out * scale + offset
+ */
+struct frame_transform {
+  float scale_x = 1, scale_y = 1;
+  float offset_x = 0, offset_y = 0;
+};
+
+enum class tensor_dtype { uint8, int8, fp16 };
+
+/*
+ * Memory layout of a frame as a model input tensor. Dimensions and byte
+ * strides are in N, C, H, W order whatever the storage order is.
+ */
+struct tensor_desc {
+  tensor_dtype dtype = tensor_dtype::uint8;
+  int dims[4] = {};
+  int strides[4] = {};
+};
+
+// Planar R, G, B tensor (C x H x W, w*h bytes per channel) in one dmabuf.
+// Not a DRM format, the code doesn't collide with one.
+#define FORMAT_RGB_CHW 0x33484352 // 'R', 'C', 'H', '3'
+
+// one renderable alias of (a part of) an output dmabuf
+struct egl_dma_target {
+  EGLImage img = 0;
+  GLuint rb = 0, fb = 0;
+  int w, h;
+};
 
 struct egl_dma_frame {
   int fd = -1;
@@ -50,7 +92,24 @@ struct egl_dma_frame {
   int size_bytes;
   int drm_format;
   int w, h;
+  // signals once the GPU finished writing the frame
+  egl_frame_fence fence;
+  frame_transform transform;
+  tensor_desc tensor;
+  // CPU mapping, only kept for outputs that are filled by a readback
+  void *map = nullptr;
+  // render targets of formats that can't be rendered as is (NV12: Y, UV,
+  // RGB888/R8: packed RGBA8888 alias), empty when `fb` covers the frame
+  std::vector<egl_dma_target> planes;
 };
+EGLImageKHR create_abgr16f_drm(int w, int h, int fd, EGLDisplay disp,
+                               int offset);
+
+/*
+ * DRM_FORMAT_ABGR16161616F frames render into the dmabuf or into an
+ * offscreen half float/RGBA8 texture that read_back_fp16 copies from,
+ * depending on the mode picked by detect_fp16_caps.
+ */
 std::vector<egl_dma_frame> create_egl_frame(const v4l2_device_info &dev,
                                             const v4l2_dma_device_info &dma,
                                             EGLDisplay disp, int num_frames,